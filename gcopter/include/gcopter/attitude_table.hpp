@@ -0,0 +1,172 @@
+#ifndef ATTITUDE_TABLE_HPP
+#define ATTITUDE_TABLE_HPP
+
+#include "gcopter/trajectory.hpp"
+#include "gcopter/flatness.hpp"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+
+namespace attitude_table
+{
+
+    // Thrust, attitude, body rate and Euler angles (ZYX, in rad) at one time
+    struct Attitude
+    {
+        double thr;
+        Eigen::Vector4d quat;
+        Eigen::Vector3d omg;
+        double tilt;
+        double roll;
+        double pitch;
+        double yaw;
+    };
+
+    // Flatness outputs of a trajectory tabulated on a uniform time grid once
+    // after planning, so that a control loop only interpolates two adjacent
+    // samples instead of running the flatness map and inverse trigonometry.
+    // Quaternion signs and the roll and yaw angles are made continuous along
+    // the table to keep linear interpolation valid across +-pi.
+    template <int D>
+    class AttitudeTable
+    {
+    private:
+        enum
+        {
+            THR = 0,
+            QUAT = 1,
+            OMG = 5,
+            TILT = 8,
+            ROLL = 9,
+            PITCH = 10,
+            YAW = 11,
+            ROWS = 12
+        };
+
+        double dt;
+        double duration;
+        Eigen::Matrix<double, ROWS, Eigen::Dynamic> table;
+
+        static inline double unwrap(const double &angle, const double &ref)
+        {
+            return ref + std::remainder(angle - ref, 2.0 * M_PI);
+        }
+
+    public:
+        AttitudeTable()
+            : dt(0.0), duration(0.0) {}
+
+        // Tabulate traj at a resolution no coarser than resolution, with the
+        // yaw aligned to the horizontal velocity as it is flown, regardless of
+        // the yaw used by the penalties in trajectory optimization
+        inline bool build(const Trajectory<D> &traj,
+                          const flatness::FlatnessMap &flatMap,
+                          const double &resolution)
+        {
+            clear();
+            if (traj.getPieceNum() <= 0 || !(resolution > 0.0))
+            {
+                return false;
+            }
+
+            duration = traj.getTotalDuration();
+            if (!(duration > 0.0))
+            {
+                duration = 0.0;
+                return false;
+            }
+            const int intervs = std::max((int)std::ceil(duration / resolution), 1);
+            dt = duration / intervs;
+            table.resize(ROWS, intervs + 1);
+
+            flatness::FlatnessCache cache;
+            double thr;
+            Eigen::Vector4d quat;
+            Eigen::Vector3d omg;
+            int cursor = -1;
+            for (int i = 0; i <= intervs; i++)
+            {
+                double t = i * dt;
+                const int pieceIdx = traj.locatePieceIdx(t, cursor);
+                const typename Piece<D>::StateMat state = traj[pieceIdx].getState(t, 3);
+                flatMap.forwardVelYaw(state.col(1), state.col(2), state.col(3),
+                                      thr, quat, omg, cache);
+
+                const double roll = atan2(2.0 * (quat(0) * quat(1) + quat(2) * quat(3)),
+                                          1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2)));
+                const double pitch = asin(std::max(-1.0, std::min(1.0, 2.0 * (quat(0) * quat(2) - quat(3) * quat(1)))));
+                const double yaw = atan2(2.0 * (quat(0) * quat(3) + quat(1) * quat(2)),
+                                         1.0 - 2.0 * (quat(2) * quat(2) + quat(3) * quat(3)));
+                table(THR, i) = thr;
+                table.template block<4, 1>(QUAT, i) = quat;
+                table.template block<3, 1>(OMG, i) = omg;
+                table(TILT, i) = acos(1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2)));
+                table(ROLL, i) = roll;
+                table(PITCH, i) = pitch;
+                table(YAW, i) = yaw;
+                if (i > 0)
+                {
+                    if (table.template block<4, 1>(QUAT, i - 1).dot(quat) < 0.0)
+                    {
+                        table.template block<4, 1>(QUAT, i) = -quat;
+                    }
+                    table(ROLL, i) = unwrap(roll, table(ROLL, i - 1));
+                    table(YAW, i) = unwrap(yaw, table(YAW, i - 1));
+                }
+            }
+
+            return true;
+        }
+
+        inline void clear()
+        {
+            dt = 0.0;
+            duration = 0.0;
+            table.resize(ROWS, 0);
+            return;
+        }
+
+        inline bool isEmpty() const
+        {
+            return table.cols() == 0;
+        }
+
+        inline double getDuration() const
+        {
+            return duration;
+        }
+
+        inline double getResolution() const
+        {
+            return dt;
+        }
+
+        // Interpolated lookup in O(1) for t within [0, duration]
+        inline bool query(const double &t, Attitude &att) const
+        {
+            if (isEmpty() || !(t >= 0.0 && t <= duration))
+            {
+                return false;
+            }
+
+            const int idx = std::min((int)(t / dt), (int)table.cols() - 2);
+            const double alpha = std::min(t / dt - idx, 1.0);
+            const Eigen::Matrix<double, ROWS, 1> row =
+                (1.0 - alpha) * table.col(idx) + alpha * table.col(idx + 1);
+
+            att.thr = row(THR);
+            att.quat = row.template segment<4>(QUAT).normalized();
+            att.omg = row.template segment<3>(OMG);
+            att.tilt = row(TILT);
+            att.roll = std::remainder(row(ROLL), 2.0 * M_PI);
+            att.pitch = row(PITCH);
+            att.yaw = std::remainder(row(YAW), 2.0 * M_PI);
+            return true;
+        }
+    };
+
+}
+
+#endif
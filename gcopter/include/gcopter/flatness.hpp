@@ -27,19 +27,82 @@
 
 #include <Eigen/Eigen>
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 namespace flatness
 {
+    // acos() for attitude penalties, replaced by a branch-free polynomial
+    // approximation if FLATNESS_FAST_MATH is defined, whose absolute error
+    // is below 2.2e-8 on [-1, 1] (Abramowitz and Stegun, 4.4.46)
+    inline double fastAcos(const double &x)
+    {
+#ifdef FLATNESS_FAST_MATH
+        const double ax = fabs(x);
+        const double r = sqrt(1.0 - ax) *
+                         (((((((-0.0012624911 * ax + 0.0066700901) * ax -
+                               0.0170881256) * ax + 0.0308918810) * ax -
+                             0.0501743046) * ax + 0.0889789874) * ax -
+                           0.2145988016) * ax + 1.5707963050);
+        return x < 0.0 ? M_PI - r : r;
+#else
+        return acos(x);
+#endif
+    }
+
+    // asin() for attitude penalties with the same error bound as fastAcos()
+    inline double fastAsin(const double &x)
+    {
+#ifdef FLATNESS_FAST_MATH
+        return M_PI_2 - fastAcos(x);
+#else
+        return asin(x);
+#endif
+    }
+
+    // Intermediate variables of FlatnessMap, which are computed in forward()
+    // and reused in backward(), either of one node with Scalar = double or of
+    // 4 nodes of a batch with Scalar = FlatnessLane
+    template <typename Scalar>
+    struct FlatnessIntermediates
+    {
+        Scalar v0, v1, v2, a0, a1, a2, v_dot_a;
+        Scalar z0, z1, z2, dz0, dz1, dz2;
+        Scalar cp_term, w_term, dh_over_m;
+        Scalar zu_sqr_norm, zu_norm, zu0, zu1, zu2;
+        Scalar zu_sqr0, zu_sqr1, zu_sqr2, zu01, zu12, zu02;
+        Scalar ng00, ng01, ng02, ng11, ng12, ng22, ng_den;
+        Scalar dw_term, dz_term0, dz_term1, dz_term2, f_term0, f_term1, f_term2;
+        Scalar tilt_den, tilt0, tilt1, tilt2, c_half_psi, s_half_psi;
+        Scalar c_psi, s_psi, omg_den, omg_term;
+        Scalar psi_sqr_den, dpsi_den, dpsi;
+    };
+
+    typedef FlatnessIntermediates<double> FlatnessCache;
+
+    // Nodes of a batch are evaluated 4 at a time, which fills an AVX2 register
+    // when built with FLATNESS_AVX2
+    typedef Eigen::Array<double, 4, 1> FlatnessLane;
+
+    // Caller-owned intermediate variables of a batch in structure-of-arrays
+    // layout, one entry for every 4 consecutive nodes
+    typedef std::vector<FlatnessIntermediates<FlatnessLane>,
+                        Eigen::aligned_allocator<FlatnessIntermediates<FlatnessLane>>>
+        FlatnessTape;
+
     class FlatnessMap  // See https://github.com/ZJU-FAST-Lab/GCOPTER/blob/main/misc/flatness.pdf
     {
     public:
+        typedef FlatnessCache Cache;
+
         inline void reset(const double &vehicle_mass,
                           const double &gravitational_acceleration,
                           const double &horitonral_drag_coeff,
                           const double &vertical_drag_coeff,
                           const double &parasitic_drag_coeff,
-                          const double &speed_smooth_factor)
+                          const double &speed_smooth_factor,
+                          const double &yaw_smooth_factor = 1.0)
         {
             mass = vehicle_mass;
             grav = gravitational_acceleration;
@@ -47,6 +110,7 @@ namespace flatness
             dv = vertical_drag_coeff;
             cp = parasitic_drag_coeff;
             veps = speed_smooth_factor;
+            yeps = yaw_smooth_factor;
 
             return;
         }
@@ -60,76 +124,7 @@ namespace flatness
                             Eigen::Vector4d &quat,
                             Eigen::Vector3d &omg)
         {
-            double w0, w1, w2, dw0, dw1, dw2;
-
-            v0 = vel(0);
-            v1 = vel(1);
-            v2 = vel(2);
-            a0 = acc(0);
-            a1 = acc(1);
-            a2 = acc(2);
-            cp_term = sqrt(v0 * v0 + v1 * v1 + v2 * v2 + veps);
-            w_term = 1.0 + cp * cp_term;
-            w0 = w_term * v0;
-            w1 = w_term * v1;
-            w2 = w_term * v2;
-            dh_over_m = dh / mass;
-            zu0 = a0 + dh_over_m * w0;
-            zu1 = a1 + dh_over_m * w1;
-            zu2 = a2 + dh_over_m * w2 + grav;
-            zu_sqr0 = zu0 * zu0;
-            zu_sqr1 = zu1 * zu1;
-            zu_sqr2 = zu2 * zu2;
-            zu01 = zu0 * zu1;
-            zu12 = zu1 * zu2;
-            zu02 = zu0 * zu2;
-            zu_sqr_norm = zu_sqr0 + zu_sqr1 + zu_sqr2;
-            zu_norm = sqrt(zu_sqr_norm);
-            z0 = zu0 / zu_norm;
-            z1 = zu1 / zu_norm;
-            z2 = zu2 / zu_norm;
-            ng_den = zu_sqr_norm * zu_norm;
-            ng00 = (zu_sqr1 + zu_sqr2) / ng_den;
-            ng01 = -zu01 / ng_den;
-            ng02 = -zu02 / ng_den;
-            ng11 = (zu_sqr0 + zu_sqr2) / ng_den;
-            ng12 = -zu12 / ng_den;
-            ng22 = (zu_sqr0 + zu_sqr1) / ng_den;
-            v_dot_a = v0 * a0 + v1 * a1 + v2 * a2;
-            dw_term = cp * v_dot_a / cp_term;
-            dw0 = w_term * a0 + dw_term * v0;
-            dw1 = w_term * a1 + dw_term * v1;
-            dw2 = w_term * a2 + dw_term * v2;
-            dz_term0 = jer(0) + dh_over_m * dw0;
-            dz_term1 = jer(1) + dh_over_m * dw1;
-            dz_term2 = jer(2) + dh_over_m * dw2;
-            dz0 = ng00 * dz_term0 + ng01 * dz_term1 + ng02 * dz_term2;
-            dz1 = ng01 * dz_term0 + ng11 * dz_term1 + ng12 * dz_term2;
-            dz2 = ng02 * dz_term0 + ng12 * dz_term1 + ng22 * dz_term2;
-            f_term0 = mass * a0 + dv * w0;
-            f_term1 = mass * a1 + dv * w1;
-            f_term2 = mass * (a2 + grav) + dv * w2;
-            thr = z0 * f_term0 + z1 * f_term1 + z2 * f_term2;
-            tilt_den = sqrt(2.0 * (1.0 + z2));
-            tilt0 = 0.5 * tilt_den;
-            tilt1 = -z1 / tilt_den;
-            tilt2 = z0 / tilt_den;
-            c_half_psi = cos(0.5 * psi);
-            s_half_psi = sin(0.5 * psi);
-            quat(0) = tilt0 * c_half_psi;
-            quat(1) = tilt1 * c_half_psi + tilt2 * s_half_psi;
-            quat(2) = tilt2 * c_half_psi - tilt1 * s_half_psi;
-            quat(3) = tilt0 * s_half_psi;
-            c_psi = cos(psi);
-            s_psi = sin(psi);
-            omg_den = z2 + 1.0;
-            omg_term = dz2 / omg_den;
-            omg(0) = dz0 * s_psi - dz1 * c_psi -
-                     (z0 * s_psi - z1 * c_psi) * omg_term;
-            omg(1) = dz0 * c_psi + dz1 * s_psi -
-                     (z0 * c_psi + z1 * s_psi) * omg_term;
-            omg(2) = (z1 * dz0 - z0 * dz1) / omg_den + dpsi;
-
+            forward(vel, acc, jer, psi, dpsi, thr, quat, omg, cache);
             return;
         }
 
@@ -145,132 +140,877 @@ namespace flatness
                              double &psi_total_grad,
                              double &dpsi_total_grad) const
         {
-            double w0b, w1b, w2b, dw0b, dw1b, dw2b;
-            double z0b, z1b, z2b, dz0b, dz1b, dz2b;
-            double v_sqr_normb, cp_termb, w_termb;
-            double zu_sqr_normb, zu_normb, zu0b, zu1b, zu2b;
-            double zu_sqr0b, zu_sqr1b, zu_sqr2b, zu01b, zu12b, zu02b;
-            double ng00b, ng01b, ng02b, ng11b, ng12b, ng22b, ng_denb;
-            double dz_term0b, dz_term1b, dz_term2b, f_term0b, f_term1b, f_term2b;
-            double tilt_denb, tilt0b, tilt1b, tilt2b, head0b, head3b;
-            double cpsib, spsib, omg_denb, omg_termb;
-            double tempb, tilt_den_sqr;
-
-            tilt0b = s_half_psi * (quat_grad(3)) + c_half_psi * (quat_grad(0));
-            head3b = tilt0 * (quat_grad(3)) + tilt2 * (quat_grad(1)) - tilt1 * (quat_grad(2));
-            tilt2b = c_half_psi * (quat_grad(2)) + s_half_psi * (quat_grad(1));
-            head0b = tilt2 * (quat_grad(2)) + tilt1 * (quat_grad(1)) + tilt0 * (quat_grad(0));
-            tilt1b = c_half_psi * (quat_grad(1)) - s_half_psi * (quat_grad(2));
-            tilt_den_sqr = tilt_den * tilt_den;
-            tilt_denb = (z1 * tilt1b - z0 * tilt2b) / tilt_den_sqr + 0.5 * tilt0b;
-            omg_termb = -((z0 * c_psi + z1 * s_psi) * (omg_grad(1))) -
-                        (z0 * s_psi - z1 * c_psi) * (omg_grad(0));
-            tempb = omg_grad(2) / omg_den;
-            dpsi_total_grad = omg_grad(2);
-            z1b = dz0 * tempb;
-            dz0b = z1 * tempb + c_psi * (omg_grad(1)) + s_psi * (omg_grad(0));
-            z0b = -(dz1 * tempb);
-            dz1b = s_psi * (omg_grad(1)) - z0 * tempb - c_psi * (omg_grad(0));
-            omg_denb = -((z1 * dz0 - z0 * dz1) * tempb / omg_den) -
-                       dz2 * omg_termb / (omg_den * omg_den);
-            tempb = -(omg_term * (omg_grad(1)));
-            cpsib = dz0 * (omg_grad(1)) + z0 * tempb;
-            spsib = dz1 * (omg_grad(1)) + z1 * tempb;
-            z0b += c_psi * tempb;
-            z1b += s_psi * tempb;
-            tempb = -(omg_term * (omg_grad(0)));
-            spsib += dz0 * (omg_grad(0)) + z0 * tempb;
-            cpsib += -dz1 * (omg_grad(0)) - z1 * tempb;
-            z0b += s_psi * tempb + tilt2b / tilt_den + f_term0 * (thr_grad);
-            z1b += -c_psi * tempb - tilt1b / tilt_den + f_term1 * (thr_grad);
-            dz2b = omg_termb / omg_den;
-            z2b = omg_denb + tilt_denb / tilt_den + f_term2 * (thr_grad);
-            psi_total_grad = c_psi * spsib + 0.5 * c_half_psi * head3b -
-                             s_psi * cpsib - 0.5 * s_half_psi * head0b;
-            f_term0b = z0 * (thr_grad);
-            f_term1b = z1 * (thr_grad);
-            f_term2b = z2 * (thr_grad);
-            ng02b = dz_term0 * dz2b + dz_term2 * dz0b;
-            dz_term0b = ng02 * dz2b + ng01 * dz1b + ng00 * dz0b;
-            ng12b = dz_term1 * dz2b + dz_term2 * dz1b;
-            dz_term1b = ng12 * dz2b + ng11 * dz1b + ng01 * dz0b;
-            ng22b = dz_term2 * dz2b;
-            dz_term2b = ng22 * dz2b + ng12 * dz1b + ng02 * dz0b;
-            ng01b = dz_term0 * dz1b + dz_term1 * dz0b;
-            ng11b = dz_term1 * dz1b;
-            ng00b = dz_term0 * dz0b;
-            jer_total_grad(2) = dz_term2b;
-            dw2b = dh_over_m * dz_term2b;
-            jer_total_grad(1) = dz_term1b;
-            dw1b = dh_over_m * dz_term1b;
-            jer_total_grad(0) = dz_term0b;
-            dw0b = dh_over_m * dz_term0b;
-            tempb = cp * (v2 * dw2b + v1 * dw1b + v0 * dw0b) / cp_term;
-            acc_total_grad(2) = mass * f_term2b + w_term * dw2b + v2 * tempb;
-            acc_total_grad(1) = mass * f_term1b + w_term * dw1b + v1 * tempb;
-            acc_total_grad(0) = mass * f_term0b + w_term * dw0b + v0 * tempb;
-            vel_total_grad(2) = dw_term * dw2b + a2 * tempb;
-            vel_total_grad(1) = dw_term * dw1b + a1 * tempb;
-            vel_total_grad(0) = dw_term * dw0b + a0 * tempb;
-            cp_termb = -(v_dot_a * tempb / cp_term);
-            tempb = ng22b / ng_den;
+            backward(pos_grad, vel_grad, thr_grad, quat_grad, omg_grad,
+                     pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad,
+                     psi_total_grad, dpsi_total_grad, cache);
+            return;
+        }
+
+        // Same as above with psi = dpsi = 0
+        inline void forward(const Eigen::Vector3d &vel,
+                            const Eigen::Vector3d &acc,
+                            const Eigen::Vector3d &jer,
+                            double &thr,
+                            Eigen::Vector4d &quat,
+                            Eigen::Vector3d &omg)
+        {
+            forward(vel, acc, jer, thr, quat, omg, cache);
+            return;
+        }
+
+        inline void backward(const Eigen::Vector3d &pos_grad,
+                             const Eigen::Vector3d &vel_grad,
+                             const double &thr_grad,
+                             const Eigen::Vector4d &quat_grad,
+                             const Eigen::Vector3d &omg_grad,
+                             Eigen::Vector3d &pos_total_grad,
+                             Eigen::Vector3d &vel_total_grad,
+                             Eigen::Vector3d &acc_total_grad,
+                             Eigen::Vector3d &jer_total_grad) const
+        {
+            backward(pos_grad, vel_grad, thr_grad, quat_grad, omg_grad,
+                     pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad, cache);
+            return;
+        }
+
+        // Same as above with the velocity-aligned yaw, see forwardVelYaw()
+        inline void forwardVelYaw(const Eigen::Vector3d &vel,
+                                  const Eigen::Vector3d &acc,
+                                  const Eigen::Vector3d &jer,
+                                  double &thr,
+                                  Eigen::Vector4d &quat,
+                                  Eigen::Vector3d &omg)
+        {
+            forwardVelYaw(vel, acc, jer, thr, quat, omg, cache);
+            return;
+        }
+
+        inline void forwardVelYawSmooth(const Eigen::Vector3d &vel,
+                                        const Eigen::Vector3d &acc,
+                                        const Eigen::Vector3d &jer,
+                                        double &thr,
+                                        Eigen::Vector4d &quat,
+                                        Eigen::Vector3d &omg)
+        {
+            forwardVelYawSmooth(vel, acc, jer, thr, quat, omg, cache);
+            return;
+        }
+
+        inline void backwardVelYaw(const Eigen::Vector3d &pos_grad,
+                                   const Eigen::Vector3d &vel_grad,
+                                   const double &thr_grad,
+                                   const Eigen::Vector4d &quat_grad,
+                                   const Eigen::Vector3d &omg_grad,
+                                   Eigen::Vector3d &pos_total_grad,
+                                   Eigen::Vector3d &vel_total_grad,
+                                   Eigen::Vector3d &acc_total_grad,
+                                   Eigen::Vector3d &jer_total_grad) const
+        {
+            backwardVelYaw(pos_grad, vel_grad, thr_grad, quat_grad, omg_grad,
+                           pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad, cache);
+            return;
+        }
+
+        // Reentrant forward() and backward() for one node, where the
+        // intermediate variables go to a cache given by the caller
+        inline void forward(const Eigen::Vector3d &vel,
+                            const Eigen::Vector3d &acc,
+                            const Eigen::Vector3d &jer,
+                            const double &psi,
+                            const double &dpsi,
+                            double &thr,
+                            Eigen::Vector4d &quat,
+                            Eigen::Vector3d &omg,
+                            FlatnessCache &c) const
+        {
+            forwardYaw(vel.data(), acc.data(), jer.data(), psi, dpsi,
+                       thr, quat.data(), omg.data(), c);
+            return;
+        }
+
+        inline void backward(const Eigen::Vector3d &pos_grad,
+                             const Eigen::Vector3d &vel_grad,
+                             const double &thr_grad,
+                             const Eigen::Vector4d &quat_grad,
+                             const Eigen::Vector3d &omg_grad,
+                             Eigen::Vector3d &pos_total_grad,
+                             Eigen::Vector3d &vel_total_grad,
+                             Eigen::Vector3d &acc_total_grad,
+                             Eigen::Vector3d &jer_total_grad,
+                             double &psi_total_grad,
+                             double &dpsi_total_grad,
+                             const FlatnessCache &c) const
+        {
+            backwardYaw(pos_grad.data(), vel_grad.data(), thr_grad, quat_grad.data(), omg_grad.data(),
+                        pos_total_grad.data(), vel_total_grad.data(), acc_total_grad.data(), jer_total_grad.data(),
+                        psi_total_grad, dpsi_total_grad, c);
+            return;
+        }
+
+        // Specialization of forward() for psi = dpsi = 0, which is how the
+        // attitude is parameterized in trajectory optimization
+        inline void forward(const Eigen::Vector3d &vel,
+                            const Eigen::Vector3d &acc,
+                            const Eigen::Vector3d &jer,
+                            double &thr,
+                            Eigen::Vector4d &quat,
+                            Eigen::Vector3d &omg,
+                            FlatnessCache &c) const
+        {
+            forwardZeroYaw(vel.data(), acc.data(), jer.data(), thr, quat.data(), omg.data(), c);
+            return;
+        }
+
+        // Specialization of backward() for psi = dpsi = 0, whose gradients
+        // w.r.t. psi and dpsi are not computed
+        inline void backward(const Eigen::Vector3d &pos_grad,
+                             const Eigen::Vector3d &vel_grad,
+                             const double &thr_grad,
+                             const Eigen::Vector4d &quat_grad,
+                             const Eigen::Vector3d &omg_grad,
+                             Eigen::Vector3d &pos_total_grad,
+                             Eigen::Vector3d &vel_total_grad,
+                             Eigen::Vector3d &acc_total_grad,
+                             Eigen::Vector3d &jer_total_grad,
+                             const FlatnessCache &c) const
+        {
+            backwardZeroYaw(pos_grad.data(), vel_grad.data(), thr_grad, quat_grad.data(), omg_grad.data(),
+                            pos_total_grad.data(), vel_total_grad.data(), acc_total_grad.data(), jer_total_grad.data(),
+                            c);
+            return;
+        }
+
+        // Velocity-aligned yaw, i.e., psi = atan2(v1, v0) whose derivative is
+        // dpsi = (v0 * a1 - v1 * a0) / (v0^2 + v1^2). This is the attitude that
+        // is flown, thus the one for execution outputs. At exact hover, where
+        // the yaw is undefined, psi = atan2(0, 0) = 0 and dpsi = 0 are used.
+        inline void forwardVelYaw(const Eigen::Vector3d &vel,
+                                  const Eigen::Vector3d &acc,
+                                  const Eigen::Vector3d &jer,
+                                  double &thr,
+                                  Eigen::Vector4d &quat,
+                                  Eigen::Vector3d &omg,
+                                  FlatnessCache &c) const
+        {
+            forwardVelocityYaw(vel.data(), acc.data(), jer.data(), 0.0,
+                               thr, quat.data(), omg.data(), c);
+            return;
+        }
+
+        // Same as forwardVelYaw() with the denominator of dpsi smoothed by
+        // yaw_smooth_factor (in m^2/s^2), so that the yaw rate and its gradient
+        // stay bounded when the optimizer passes near hover. A factor much below
+        // 1.0 easily breaks the line search there. As the yaw rate is scaled by
+        // v^2 / (v^2 + yaw_smooth_factor) for the horizontal speed v, this is
+        // only meant for the penalties in trajectory optimization.
+        inline void forwardVelYawSmooth(const Eigen::Vector3d &vel,
+                                        const Eigen::Vector3d &acc,
+                                        const Eigen::Vector3d &jer,
+                                        double &thr,
+                                        Eigen::Vector4d &quat,
+                                        Eigen::Vector3d &omg,
+                                        FlatnessCache &c) const
+        {
+            forwardVelocityYaw(vel.data(), acc.data(), jer.data(), yeps,
+                               thr, quat.data(), omg.data(), c);
+            return;
+        }
+
+        // Backward of forwardVelYaw() or forwardVelYawSmooth(), where the
+        // gradients of psi and dpsi are propagated to vel and acc. Both are
+        // taken as zero at exact hover if the denominator is not smoothed.
+        inline void backwardVelYaw(const Eigen::Vector3d &pos_grad,
+                                   const Eigen::Vector3d &vel_grad,
+                                   const double &thr_grad,
+                                   const Eigen::Vector4d &quat_grad,
+                                   const Eigen::Vector3d &omg_grad,
+                                   Eigen::Vector3d &pos_total_grad,
+                                   Eigen::Vector3d &vel_total_grad,
+                                   Eigen::Vector3d &acc_total_grad,
+                                   Eigen::Vector3d &jer_total_grad,
+                                   const FlatnessCache &c) const
+        {
+            backwardVelocityYaw(pos_grad.data(), vel_grad.data(), thr_grad, quat_grad.data(), omg_grad.data(),
+                                pos_total_grad.data(), vel_total_grad.data(), acc_total_grad.data(), jer_total_grad.data(),
+                                c);
+            return;
+        }
+
+        // Batched forward() with psi = dpsi = 0 over the nodes given as rows of
+        // structure-of-arrays buffers, i.e., each column is contiguous over the
+        // nodes. Every 4 consecutive nodes are evaluated together as one
+        // FlatnessLane, which Eigen maps to SIMD registers, and their intermediate
+        // variables are kept in the caller-owned tape. As the map itself is not
+        // modified, threads with their own tapes can share one map. Nothing is
+        // allocated once the outputs and the tape are sized for the nodes.
+        inline void forwardBatch(const Eigen::MatrixX3d &vel,
+                                 const Eigen::MatrixX3d &acc,
+                                 const Eigen::MatrixX3d &jer,
+                                 Eigen::VectorXd &thr,
+                                 Eigen::MatrixX4d &quat,
+                                 Eigen::MatrixX3d &omg,
+                                 FlatnessTape &tape) const
+        {
+            const int n = vel.rows();
+            FlatnessLane v[3], a[3], j[3], t, q[4], w[3];
+
+            thr.resize(n);
+            quat.resize(n, 4);
+            omg.resize(n, 3);
+            tape.resize((n + 3) / 4);
+            for (int b = 0; 4 * b < n; b++)
+            {
+                loadLanes(vel, b, v);
+                loadLanes(acc, b, a);
+                loadLanes(jer, b, j);
+                forwardZeroYaw(v, a, j, t, q, w, tape[b]);
+                storeLanes(&t, b, thr);
+                storeLanes(q, b, quat);
+                storeLanes(w, b, omg);
+            }
+
+            return;
+        }
+
+        // Batched backward() with psi = dpsi = 0 through the tape filled by
+        // the above forwardBatch()
+        inline void backwardBatch(const Eigen::MatrixX3d &pos_grad,
+                                  const Eigen::MatrixX3d &vel_grad,
+                                  const Eigen::VectorXd &thr_grad,
+                                  const Eigen::MatrixX4d &quat_grad,
+                                  const Eigen::MatrixX3d &omg_grad,
+                                  Eigen::MatrixX3d &pos_total_grad,
+                                  Eigen::MatrixX3d &vel_total_grad,
+                                  Eigen::MatrixX3d &acc_total_grad,
+                                  Eigen::MatrixX3d &jer_total_grad,
+                                  const FlatnessTape &tape) const
+        {
+            const int n = pos_grad.rows();
+            FlatnessLane pg[3], vg[3], tg, qg[4], wg[3], ptg[3], vtg[3], atg[3], jtg[3];
+
+            resizeTotalGrads(n, pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad);
+            for (int b = 0; 4 * b < n; b++)
+            {
+                loadLanes(pos_grad, b, pg);
+                loadLanes(vel_grad, b, vg);
+                loadLanes(thr_grad, b, &tg);
+                loadLanes(quat_grad, b, qg);
+                loadLanes(omg_grad, b, wg);
+                backwardZeroYaw(pg, vg, tg, qg, wg, ptg, vtg, atg, jtg, tape[b]);
+                storeLanes(ptg, b, pos_total_grad);
+                storeLanes(vtg, b, vel_total_grad);
+                storeLanes(atg, b, acc_total_grad);
+                storeLanes(jtg, b, jer_total_grad);
+            }
+
+            return;
+        }
+
+        // Batched forward() with the yaw and its rate given per node
+        inline void forwardBatch(const Eigen::MatrixX3d &vel,
+                                 const Eigen::MatrixX3d &acc,
+                                 const Eigen::MatrixX3d &jer,
+                                 const Eigen::VectorXd &psi,
+                                 const Eigen::VectorXd &dpsi,
+                                 Eigen::VectorXd &thr,
+                                 Eigen::MatrixX4d &quat,
+                                 Eigen::MatrixX3d &omg,
+                                 FlatnessTape &tape) const
+        {
+            const int n = vel.rows();
+            FlatnessLane v[3], a[3], j[3], p, dp, t, q[4], w[3];
+
+            thr.resize(n);
+            quat.resize(n, 4);
+            omg.resize(n, 3);
+            tape.resize((n + 3) / 4);
+            for (int b = 0; 4 * b < n; b++)
+            {
+                loadLanes(vel, b, v);
+                loadLanes(acc, b, a);
+                loadLanes(jer, b, j);
+                loadLanes(psi, b, &p);
+                loadLanes(dpsi, b, &dp);
+                forwardYaw(v, a, j, p, dp, t, q, w, tape[b]);
+                storeLanes(&t, b, thr);
+                storeLanes(q, b, quat);
+                storeLanes(w, b, omg);
+            }
+
+            return;
+        }
+
+        inline void backwardBatch(const Eigen::MatrixX3d &pos_grad,
+                                  const Eigen::MatrixX3d &vel_grad,
+                                  const Eigen::VectorXd &thr_grad,
+                                  const Eigen::MatrixX4d &quat_grad,
+                                  const Eigen::MatrixX3d &omg_grad,
+                                  Eigen::MatrixX3d &pos_total_grad,
+                                  Eigen::MatrixX3d &vel_total_grad,
+                                  Eigen::MatrixX3d &acc_total_grad,
+                                  Eigen::MatrixX3d &jer_total_grad,
+                                  Eigen::VectorXd &psi_total_grad,
+                                  Eigen::VectorXd &dpsi_total_grad,
+                                  const FlatnessTape &tape) const
+        {
+            const int n = pos_grad.rows();
+            FlatnessLane pg[3], vg[3], tg, qg[4], wg[3], ptg[3], vtg[3], atg[3], jtg[3], psig, dpsig;
+
+            resizeTotalGrads(n, pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad);
+            psi_total_grad.resize(n);
+            dpsi_total_grad.resize(n);
+            for (int b = 0; 4 * b < n; b++)
+            {
+                loadLanes(pos_grad, b, pg);
+                loadLanes(vel_grad, b, vg);
+                loadLanes(thr_grad, b, &tg);
+                loadLanes(quat_grad, b, qg);
+                loadLanes(omg_grad, b, wg);
+                backwardYaw(pg, vg, tg, qg, wg, ptg, vtg, atg, jtg, psig, dpsig, tape[b]);
+                storeLanes(ptg, b, pos_total_grad);
+                storeLanes(vtg, b, vel_total_grad);
+                storeLanes(atg, b, acc_total_grad);
+                storeLanes(jtg, b, jer_total_grad);
+                storeLanes(&psig, b, psi_total_grad);
+                storeLanes(&dpsig, b, dpsi_total_grad);
+            }
+
+            return;
+        }
+
+        // Batched forwardVelYawSmooth(), see forwardBatch()
+        inline void forwardVelYawSmoothBatch(const Eigen::MatrixX3d &vel,
+                                             const Eigen::MatrixX3d &acc,
+                                             const Eigen::MatrixX3d &jer,
+                                             Eigen::VectorXd &thr,
+                                             Eigen::MatrixX4d &quat,
+                                             Eigen::MatrixX3d &omg,
+                                             FlatnessTape &tape) const
+        {
+            const int n = vel.rows();
+            FlatnessLane v[3], a[3], j[3], t, q[4], w[3];
+
+            thr.resize(n);
+            quat.resize(n, 4);
+            omg.resize(n, 3);
+            tape.resize((n + 3) / 4);
+            for (int b = 0; 4 * b < n; b++)
+            {
+                loadLanes(vel, b, v);
+                loadLanes(acc, b, a);
+                loadLanes(jer, b, j);
+                forwardVelocityYaw(v, a, j, yeps, t, q, w, tape[b]);
+                storeLanes(&t, b, thr);
+                storeLanes(q, b, quat);
+                storeLanes(w, b, omg);
+            }
+
+            return;
+        }
+
+        // Batched backwardVelYaw() through the tape filled by
+        // forwardVelYawSmoothBatch()
+        inline void backwardVelYawBatch(const Eigen::MatrixX3d &pos_grad,
+                                        const Eigen::MatrixX3d &vel_grad,
+                                        const Eigen::VectorXd &thr_grad,
+                                        const Eigen::MatrixX4d &quat_grad,
+                                        const Eigen::MatrixX3d &omg_grad,
+                                        Eigen::MatrixX3d &pos_total_grad,
+                                        Eigen::MatrixX3d &vel_total_grad,
+                                        Eigen::MatrixX3d &acc_total_grad,
+                                        Eigen::MatrixX3d &jer_total_grad,
+                                        const FlatnessTape &tape) const
+        {
+            const int n = pos_grad.rows();
+            FlatnessLane pg[3], vg[3], tg, qg[4], wg[3], ptg[3], vtg[3], atg[3], jtg[3];
+
+            resizeTotalGrads(n, pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad);
+            for (int b = 0; 4 * b < n; b++)
+            {
+                loadLanes(pos_grad, b, pg);
+                loadLanes(vel_grad, b, vg);
+                loadLanes(thr_grad, b, &tg);
+                loadLanes(quat_grad, b, qg);
+                loadLanes(omg_grad, b, wg);
+                backwardVelocityYaw(pg, vg, tg, qg, wg, ptg, vtg, atg, jtg, tape[b]);
+                storeLanes(ptg, b, pos_total_grad);
+                storeLanes(vtg, b, vel_total_grad);
+                storeLanes(atg, b, acc_total_grad);
+                storeLanes(jtg, b, jer_total_grad);
+            }
+
+            return;
+        }
+
+    private:
+        // Lanes of the b-th group of 4 nodes in each column of buf, where the
+        // nodes past the last one repeat it so that every lane stays finite
+        template <int C>
+        static inline void loadLanes(const Eigen::Matrix<double, Eigen::Dynamic, C> &buf,
+                                     const int &b, FlatnessLane *x)
+        {
+            const int m = std::min(4, (int)buf.rows() - 4 * b);
+            for (int k = 0; k < buf.cols(); k++)
+            {
+                if (m == 4)
+                {
+                    x[k] = buf.col(k).template segment<4>(4 * b);
+                }
+                else
+                {
+                    x[k].setConstant(buf(4 * b + m - 1, k));
+                    x[k].head(m) = buf.col(k).segment(4 * b, m);
+                }
+            }
+            return;
+        }
+
+        template <int C>
+        static inline void storeLanes(const FlatnessLane *x, const int &b,
+                                      Eigen::Matrix<double, Eigen::Dynamic, C> &buf)
+        {
+            const int m = std::min(4, (int)buf.rows() - 4 * b);
+            for (int k = 0; k < buf.cols(); k++)
+            {
+                if (m == 4)
+                {
+                    buf.col(k).template segment<4>(4 * b) = x[k];
+                }
+                else
+                {
+                    buf.col(k).segment(4 * b, m) = x[k].head(m);
+                }
+            }
+            return;
+        }
+
+        static inline void resizeTotalGrads(const int &n,
+                                            Eigen::MatrixX3d &pos_total_grad,
+                                            Eigen::MatrixX3d &vel_total_grad,
+                                            Eigen::MatrixX3d &acc_total_grad,
+                                            Eigen::MatrixX3d &jer_total_grad)
+        {
+            pos_total_grad.resize(n, 3);
+            vel_total_grad.resize(n, 3);
+            acc_total_grad.resize(n, 3);
+            jer_total_grad.resize(n, 3);
+            return;
+        }
+
+        // The transcendental functions are evaluated node by node, so that
+        // a lane gives exactly the same yaw terms as a single node
+        static inline void setYaw(const double &psi, FlatnessCache &c)
+        {
+            c.c_half_psi = cos(0.5 * psi);
+            c.s_half_psi = sin(0.5 * psi);
+            c.c_psi = cos(psi);
+            c.s_psi = sin(psi);
+            return;
+        }
+
+        static inline void setYaw(const FlatnessLane &psi, FlatnessIntermediates<FlatnessLane> &c)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                c.c_half_psi(k) = cos(0.5 * psi(k));
+                c.s_half_psi(k) = sin(0.5 * psi(k));
+                c.c_psi(k) = cos(psi(k));
+                c.s_psi(k) = sin(psi(k));
+            }
+            return;
+        }
+
+        static inline double horizontalYaw(const double *vel)
+        {
+            return atan2(vel[1], vel[0]);
+        }
+
+        static inline FlatnessLane horizontalYaw(const FlatnessLane *vel)
+        {
+            FlatnessLane psi;
+            for (int k = 0; k < 4; k++)
+            {
+                psi(k) = atan2(vel[1](k), vel[0](k));
+            }
+            return psi;
+        }
+
+        // num / den for a positive den and zero otherwise
+        static inline double safeQuotient(const double &num, const double &den)
+        {
+            return den > 0.0 ? num / den : 0.0;
+        }
+
+        static inline FlatnessLane safeQuotient(const FlatnessLane &num, const FlatnessLane &den)
+        {
+            return (den > 0.0).select(num / den, 0.0);
+        }
+
+        // The kernels below are shared by single nodes with S = double and by
+        // lanes of nodes with S = FlatnessLane, where vectors are passed as
+        // pointers to their components
+        template <typename S>
+        inline void forwardYaw(const S *vel,
+                               const S *acc,
+                               const S *jer,
+                               const S &psi,
+                               const S &dpsi,
+                               S &thr,
+                               S *quat,
+                               S *omg,
+                               FlatnessIntermediates<S> &c) const
+        {
+            forwardAxis(vel, acc, jer, thr, c);
+            setYaw(psi, c);
+            quat[0] = c.tilt0 * c.c_half_psi;
+            quat[1] = c.tilt1 * c.c_half_psi + c.tilt2 * c.s_half_psi;
+            quat[2] = c.tilt2 * c.c_half_psi - c.tilt1 * c.s_half_psi;
+            quat[3] = c.tilt0 * c.s_half_psi;
+            omg[0] = c.dz0 * c.s_psi - c.dz1 * c.c_psi -
+                     (c.z0 * c.s_psi - c.z1 * c.c_psi) * c.omg_term;
+            omg[1] = c.dz0 * c.c_psi + c.dz1 * c.s_psi -
+                     (c.z0 * c.c_psi + c.z1 * c.s_psi) * c.omg_term;
+            omg[2] = (c.z1 * c.dz0 - c.z0 * c.dz1) / c.omg_den + dpsi;
+
+            return;
+        }
+
+        template <typename S>
+        inline void backwardYaw(const S *pos_grad,
+                                const S *vel_grad,
+                                const S &thr_grad,
+                                const S *quat_grad,
+                                const S *omg_grad,
+                                S *pos_total_grad,
+                                S *vel_total_grad,
+                                S *acc_total_grad,
+                                S *jer_total_grad,
+                                S &psi_total_grad,
+                                S &dpsi_total_grad,
+                                const FlatnessIntermediates<S> &c) const
+        {
+            S z0b, z1b, z2b, dz0b, dz1b, dz2b;
+            S tilt_denb, tilt0b, tilt1b, tilt2b, head0b, head3b;
+            S cpsib, spsib, omg_denb, omg_termb;
+            S tempb, tilt_den_sqr;
+
+            tilt0b = c.s_half_psi * (quat_grad[3]) + c.c_half_psi * (quat_grad[0]);
+            head3b = c.tilt0 * (quat_grad[3]) + c.tilt2 * (quat_grad[1]) - c.tilt1 * (quat_grad[2]);
+            tilt2b = c.c_half_psi * (quat_grad[2]) + c.s_half_psi * (quat_grad[1]);
+            head0b = c.tilt2 * (quat_grad[2]) + c.tilt1 * (quat_grad[1]) + c.tilt0 * (quat_grad[0]);
+            tilt1b = c.c_half_psi * (quat_grad[1]) - c.s_half_psi * (quat_grad[2]);
+            tilt_den_sqr = c.tilt_den * c.tilt_den;
+            tilt_denb = (c.z1 * tilt1b - c.z0 * tilt2b) / tilt_den_sqr + 0.5 * tilt0b;
+            omg_termb = -((c.z0 * c.c_psi + c.z1 * c.s_psi) * (omg_grad[1])) -
+                        (c.z0 * c.s_psi - c.z1 * c.c_psi) * (omg_grad[0]);
+            tempb = omg_grad[2] / c.omg_den;
+            dpsi_total_grad = omg_grad[2];
+            z1b = c.dz0 * tempb;
+            dz0b = c.z1 * tempb + c.c_psi * (omg_grad[1]) + c.s_psi * (omg_grad[0]);
+            z0b = -(c.dz1 * tempb);
+            dz1b = c.s_psi * (omg_grad[1]) - c.z0 * tempb - c.c_psi * (omg_grad[0]);
+            omg_denb = -((c.z1 * c.dz0 - c.z0 * c.dz1) * tempb / c.omg_den) -
+                       c.dz2 * omg_termb / (c.omg_den * c.omg_den);
+            tempb = -(c.omg_term * (omg_grad[1]));
+            cpsib = c.dz0 * (omg_grad[1]) + c.z0 * tempb;
+            spsib = c.dz1 * (omg_grad[1]) + c.z1 * tempb;
+            z0b += c.c_psi * tempb;
+            z1b += c.s_psi * tempb;
+            tempb = -(c.omg_term * (omg_grad[0]));
+            spsib += c.dz0 * (omg_grad[0]) + c.z0 * tempb;
+            cpsib += -c.dz1 * (omg_grad[0]) - c.z1 * tempb;
+            z0b += c.s_psi * tempb + tilt2b / c.tilt_den + c.f_term0 * (thr_grad);
+            z1b += -c.c_psi * tempb - tilt1b / c.tilt_den + c.f_term1 * (thr_grad);
+            dz2b = omg_termb / c.omg_den;
+            z2b = omg_denb + tilt_denb / c.tilt_den + c.f_term2 * (thr_grad);
+            psi_total_grad = c.c_psi * spsib + 0.5 * c.c_half_psi * head3b -
+                             c.s_psi * cpsib - 0.5 * c.s_half_psi * head0b;
+            backwardAxis(pos_grad, vel_grad, thr_grad, z0b, z1b, z2b, dz0b, dz1b, dz2b,
+                         pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad, c);
+
+            return;
+        }
+
+        template <typename S>
+        inline void forwardZeroYaw(const S *vel,
+                                   const S *acc,
+                                   const S *jer,
+                                   S &thr,
+                                   S *quat,
+                                   S *omg,
+                                   FlatnessIntermediates<S> &c) const
+        {
+            forwardAxis(vel, acc, jer, thr, c);
+            c.c_half_psi = 1.0;
+            c.s_half_psi = 0.0;
+            quat[0] = c.tilt0;
+            quat[1] = c.tilt1;
+            quat[2] = c.tilt2;
+            quat[3] = 0.0;
+            c.c_psi = 1.0;
+            c.s_psi = 0.0;
+            omg[0] = c.z1 * c.omg_term - c.dz1;
+            omg[1] = c.dz0 - c.z0 * c.omg_term;
+            omg[2] = (c.z1 * c.dz0 - c.z0 * c.dz1) / c.omg_den;
+
+            return;
+        }
+
+        template <typename S>
+        inline void backwardZeroYaw(const S *pos_grad,
+                                    const S *vel_grad,
+                                    const S &thr_grad,
+                                    const S *quat_grad,
+                                    const S *omg_grad,
+                                    S *pos_total_grad,
+                                    S *vel_total_grad,
+                                    S *acc_total_grad,
+                                    S *jer_total_grad,
+                                    const FlatnessIntermediates<S> &c) const
+        {
+            S z0b, z1b, z2b, dz0b, dz1b, dz2b;
+            S tilt_denb, omg_denb, omg_termb, tempb;
+
+            tilt_denb = (c.z1 * quat_grad[1] - c.z0 * quat_grad[2]) / (c.tilt_den * c.tilt_den) +
+                        0.5 * quat_grad[0];
+            omg_termb = c.z1 * omg_grad[0] - c.z0 * omg_grad[1];
+            tempb = omg_grad[2] / c.omg_den;
+            dz0b = c.z1 * tempb + omg_grad[1];
+            dz1b = -c.z0 * tempb - omg_grad[0];
+            dz2b = omg_termb / c.omg_den;
+            omg_denb = -((c.z1 * c.dz0 - c.z0 * c.dz1) * tempb / c.omg_den) -
+                       c.dz2 * omg_termb / (c.omg_den * c.omg_den);
+            z0b = -c.dz1 * tempb - c.omg_term * omg_grad[1] +
+                  quat_grad[2] / c.tilt_den + c.f_term0 * thr_grad;
+            z1b = c.dz0 * tempb + c.omg_term * omg_grad[0] -
+                  quat_grad[1] / c.tilt_den + c.f_term1 * thr_grad;
+            z2b = omg_denb + tilt_denb / c.tilt_den + c.f_term2 * thr_grad;
+            backwardAxis(pos_grad, vel_grad, thr_grad, z0b, z1b, z2b, dz0b, dz1b, dz2b,
+                         pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad, c);
+
+            return;
+        }
+
+        // Velocity-aligned yaw whose rate has the denominator v0^2 + v1^2 + eps
+        template <typename S>
+        inline void forwardVelocityYaw(const S *vel,
+                                       const S *acc,
+                                       const S *jer,
+                                       const double &eps,
+                                       S &thr,
+                                       S *quat,
+                                       S *omg,
+                                       FlatnessIntermediates<S> &c) const
+        {
+            const S psi = horizontalYaw(vel);
+            const S num = vel[0] * acc[1] - vel[1] * acc[0];
+            c.psi_sqr_den = vel[0] * vel[0] + vel[1] * vel[1];
+            c.dpsi_den = c.psi_sqr_den + eps;
+            c.dpsi = safeQuotient(num, c.dpsi_den);
+            forwardYaw(vel, acc, jer, psi, c.dpsi, thr, quat, omg, c);
+
+            return;
+        }
+
+        template <typename S>
+        inline void backwardVelocityYaw(const S *pos_grad,
+                                        const S *vel_grad,
+                                        const S &thr_grad,
+                                        const S *quat_grad,
+                                        const S *omg_grad,
+                                        S *pos_total_grad,
+                                        S *vel_total_grad,
+                                        S *acc_total_grad,
+                                        S *jer_total_grad,
+                                        const FlatnessIntermediates<S> &c) const
+        {
+            S psib, dpsib;
+
+            backwardYaw(pos_grad, vel_grad, thr_grad, quat_grad, omg_grad,
+                        pos_total_grad, vel_total_grad, acc_total_grad, jer_total_grad,
+                        psib, dpsib, c);
+            psib = safeQuotient(psib, c.psi_sqr_den);
+            vel_total_grad[0] -= c.v1 * psib;
+            vel_total_grad[1] += c.v0 * psib;
+            dpsib = safeQuotient(dpsib, c.dpsi_den);
+            vel_total_grad[0] += (c.a1 - 2.0 * c.v0 * c.dpsi) * dpsib;
+            vel_total_grad[1] -= (c.a0 + 2.0 * c.v1 * c.dpsi) * dpsib;
+            acc_total_grad[0] -= c.v1 * dpsib;
+            acc_total_grad[1] += c.v0 * dpsib;
+
+            return;
+        }
+
+        // Thrust, tilt and the body z-axis with its derivative, which do not
+        // depend on the yaw
+        template <typename S>
+        inline void forwardAxis(const S *vel,
+                                const S *acc,
+                                const S *jer,
+                                S &thr,
+                                FlatnessIntermediates<S> &c) const
+        {
+            S w0, w1, w2, dw0, dw1, dw2;
+
+            c.v0 = vel[0];
+            c.v1 = vel[1];
+            c.v2 = vel[2];
+            c.a0 = acc[0];
+            c.a1 = acc[1];
+            c.a2 = acc[2];
+            c.cp_term = sqrt(c.v0 * c.v0 + c.v1 * c.v1 + c.v2 * c.v2 + veps);
+            c.w_term = 1.0 + cp * c.cp_term;
+            w0 = c.w_term * c.v0;
+            w1 = c.w_term * c.v1;
+            w2 = c.w_term * c.v2;
+            c.dh_over_m = dh / mass;
+            c.zu0 = c.a0 + c.dh_over_m * w0;
+            c.zu1 = c.a1 + c.dh_over_m * w1;
+            c.zu2 = c.a2 + c.dh_over_m * w2 + grav;
+            c.zu_sqr0 = c.zu0 * c.zu0;
+            c.zu_sqr1 = c.zu1 * c.zu1;
+            c.zu_sqr2 = c.zu2 * c.zu2;
+            c.zu01 = c.zu0 * c.zu1;
+            c.zu12 = c.zu1 * c.zu2;
+            c.zu02 = c.zu0 * c.zu2;
+            c.zu_sqr_norm = c.zu_sqr0 + c.zu_sqr1 + c.zu_sqr2;
+            c.zu_norm = sqrt(c.zu_sqr_norm);
+            c.z0 = c.zu0 / c.zu_norm;
+            c.z1 = c.zu1 / c.zu_norm;
+            c.z2 = c.zu2 / c.zu_norm;
+            c.ng_den = c.zu_sqr_norm * c.zu_norm;
+            c.ng00 = (c.zu_sqr1 + c.zu_sqr2) / c.ng_den;
+            c.ng01 = -c.zu01 / c.ng_den;
+            c.ng02 = -c.zu02 / c.ng_den;
+            c.ng11 = (c.zu_sqr0 + c.zu_sqr2) / c.ng_den;
+            c.ng12 = -c.zu12 / c.ng_den;
+            c.ng22 = (c.zu_sqr0 + c.zu_sqr1) / c.ng_den;
+            c.v_dot_a = c.v0 * c.a0 + c.v1 * c.a1 + c.v2 * c.a2;
+            c.dw_term = cp * c.v_dot_a / c.cp_term;
+            dw0 = c.w_term * c.a0 + c.dw_term * c.v0;
+            dw1 = c.w_term * c.a1 + c.dw_term * c.v1;
+            dw2 = c.w_term * c.a2 + c.dw_term * c.v2;
+            c.dz_term0 = jer[0] + c.dh_over_m * dw0;
+            c.dz_term1 = jer[1] + c.dh_over_m * dw1;
+            c.dz_term2 = jer[2] + c.dh_over_m * dw2;
+            c.dz0 = c.ng00 * c.dz_term0 + c.ng01 * c.dz_term1 + c.ng02 * c.dz_term2;
+            c.dz1 = c.ng01 * c.dz_term0 + c.ng11 * c.dz_term1 + c.ng12 * c.dz_term2;
+            c.dz2 = c.ng02 * c.dz_term0 + c.ng12 * c.dz_term1 + c.ng22 * c.dz_term2;
+            c.f_term0 = mass * c.a0 + dv * w0;
+            c.f_term1 = mass * c.a1 + dv * w1;
+            c.f_term2 = mass * (c.a2 + grav) + dv * w2;
+            thr = c.z0 * c.f_term0 + c.z1 * c.f_term1 + c.z2 * c.f_term2;
+            c.tilt_den = sqrt(2.0 * (1.0 + c.z2));
+            c.tilt0 = 0.5 * c.tilt_den;
+            c.tilt1 = -c.z1 / c.tilt_den;
+            c.tilt2 = c.z0 / c.tilt_den;
+            c.omg_den = c.z2 + 1.0;
+            c.omg_term = c.dz2 / c.omg_den;
+
+            return;
+        }
+
+        // Gradient propagation from the body z-axis with its derivative,
+        // which is shared by all yaw parameterizations
+        template <typename S>
+        inline void backwardAxis(const S *pos_grad,
+                                 const S *vel_grad,
+                                 const S &thr_grad,
+                                 const S &z0b,
+                                 const S &z1b,
+                                 const S &z2b,
+                                 const S &dz0b,
+                                 const S &dz1b,
+                                 const S &dz2b,
+                                 S *pos_total_grad,
+                                 S *vel_total_grad,
+                                 S *acc_total_grad,
+                                 S *jer_total_grad,
+                                 const FlatnessIntermediates<S> &c) const
+        {
+            S w0b, w1b, w2b, dw0b, dw1b, dw2b;
+            S v_sqr_normb, cp_termb, w_termb;
+            S zu_sqr_normb, zu_normb, zu0b, zu1b, zu2b;
+            S zu_sqr0b, zu_sqr1b, zu_sqr2b, zu01b, zu12b, zu02b;
+            S ng00b, ng01b, ng02b, ng11b, ng12b, ng22b, ng_denb;
+            S dz_term0b, dz_term1b, dz_term2b, f_term0b, f_term1b, f_term2b;
+            S tempb;
+
+            f_term0b = c.z0 * (thr_grad);
+            f_term1b = c.z1 * (thr_grad);
+            f_term2b = c.z2 * (thr_grad);
+            ng02b = c.dz_term0 * dz2b + c.dz_term2 * dz0b;
+            dz_term0b = c.ng02 * dz2b + c.ng01 * dz1b + c.ng00 * dz0b;
+            ng12b = c.dz_term1 * dz2b + c.dz_term2 * dz1b;
+            dz_term1b = c.ng12 * dz2b + c.ng11 * dz1b + c.ng01 * dz0b;
+            ng22b = c.dz_term2 * dz2b;
+            dz_term2b = c.ng22 * dz2b + c.ng12 * dz1b + c.ng02 * dz0b;
+            ng01b = c.dz_term0 * dz1b + c.dz_term1 * dz0b;
+            ng11b = c.dz_term1 * dz1b;
+            ng00b = c.dz_term0 * dz0b;
+            jer_total_grad[2] = dz_term2b;
+            dw2b = c.dh_over_m * dz_term2b;
+            jer_total_grad[1] = dz_term1b;
+            dw1b = c.dh_over_m * dz_term1b;
+            jer_total_grad[0] = dz_term0b;
+            dw0b = c.dh_over_m * dz_term0b;
+            tempb = cp * (c.v2 * dw2b + c.v1 * dw1b + c.v0 * dw0b) / c.cp_term;
+            acc_total_grad[2] = mass * f_term2b + c.w_term * dw2b + c.v2 * tempb;
+            acc_total_grad[1] = mass * f_term1b + c.w_term * dw1b + c.v1 * tempb;
+            acc_total_grad[0] = mass * f_term0b + c.w_term * dw0b + c.v0 * tempb;
+            vel_total_grad[2] = c.dw_term * dw2b + c.a2 * tempb;
+            vel_total_grad[1] = c.dw_term * dw1b + c.a1 * tempb;
+            vel_total_grad[0] = c.dw_term * dw0b + c.a0 * tempb;
+            cp_termb = -(c.v_dot_a * tempb / c.cp_term);
+            tempb = ng22b / c.ng_den;
             zu_sqr0b = tempb;
             zu_sqr1b = tempb;
-            ng_denb = -((zu_sqr0 + zu_sqr1) * tempb / ng_den);
-            zu12b = -(ng12b / ng_den);
-            tempb = ng11b / ng_den;
-            ng_denb += zu12 * ng12b / (ng_den * ng_den) -
-                       (zu_sqr0 + zu_sqr2) * tempb / ng_den;
+            ng_denb = -((c.zu_sqr0 + c.zu_sqr1) * tempb / c.ng_den);
+            zu12b = -(ng12b / c.ng_den);
+            tempb = ng11b / c.ng_den;
+            ng_denb += c.zu12 * ng12b / (c.ng_den * c.ng_den) -
+                       (c.zu_sqr0 + c.zu_sqr2) * tempb / c.ng_den;
             zu_sqr0b += tempb;
             zu_sqr2b = tempb;
-            zu02b = -(ng02b / ng_den);
-            zu01b = -(ng01b / ng_den);
-            tempb = ng00b / ng_den;
-            ng_denb += zu02 * ng02b / (ng_den * ng_den) +
-                       zu01 * ng01b / (ng_den * ng_den) -
-                       (zu_sqr1 + zu_sqr2) * tempb / ng_den;
-            zu_normb = zu_sqr_norm * ng_denb -
-                       (zu2 * z2b + zu1 * z1b + zu0 * z0b) / zu_sqr_norm;
-            zu_sqr_normb = zu_norm * ng_denb + zu_normb / (2.0 * zu_norm);
+            zu02b = -(ng02b / c.ng_den);
+            zu01b = -(ng01b / c.ng_den);
+            tempb = ng00b / c.ng_den;
+            ng_denb += c.zu02 * ng02b / (c.ng_den * c.ng_den) +
+                       c.zu01 * ng01b / (c.ng_den * c.ng_den) -
+                       (c.zu_sqr1 + c.zu_sqr2) * tempb / c.ng_den;
+            zu_normb = c.zu_sqr_norm * ng_denb -
+                       (c.zu2 * z2b + c.zu1 * z1b + c.zu0 * z0b) / c.zu_sqr_norm;
+            zu_sqr_normb = c.zu_norm * ng_denb + zu_normb / (2.0 * c.zu_norm);
             tempb += zu_sqr_normb;
             zu_sqr1b += tempb;
             zu_sqr2b += tempb;
-            zu2b = z2b / zu_norm + zu0 * zu02b + zu1 * zu12b + 2 * zu2 * zu_sqr2b;
-            w2b = dv * f_term2b + dh_over_m * zu2b;
-            zu1b = z1b / zu_norm + zu2 * zu12b + zu0 * zu01b + 2 * zu1 * zu_sqr1b;
-            w1b = dv * f_term1b + dh_over_m * zu1b;
+            zu2b = z2b / c.zu_norm + c.zu0 * zu02b + c.zu1 * zu12b + 2.0 * c.zu2 * zu_sqr2b;
+            w2b = dv * f_term2b + c.dh_over_m * zu2b;
+            zu1b = z1b / c.zu_norm + c.zu2 * zu12b + c.zu0 * zu01b + 2.0 * c.zu1 * zu_sqr1b;
+            w1b = dv * f_term1b + c.dh_over_m * zu1b;
             zu_sqr0b += zu_sqr_normb;
-            zu0b = z0b / zu_norm + zu2 * zu02b + zu1 * zu01b + 2 * zu0 * zu_sqr0b;
-            w0b = dv * f_term0b + dh_over_m * zu0b;
-            w_termb = a2 * dw2b + a1 * dw1b + a0 * dw0b +
-                      v2 * w2b + v1 * w1b + v0 * w0b;
-            acc_total_grad(2) += zu2b;
-            acc_total_grad(1) += zu1b;
-            acc_total_grad(0) += zu0b;
+            zu0b = z0b / c.zu_norm + c.zu2 * zu02b + c.zu1 * zu01b + 2.0 * c.zu0 * zu_sqr0b;
+            w0b = dv * f_term0b + c.dh_over_m * zu0b;
+            w_termb = c.a2 * dw2b + c.a1 * dw1b + c.a0 * dw0b +
+                      c.v2 * w2b + c.v1 * w1b + c.v0 * w0b;
+            acc_total_grad[2] += zu2b;
+            acc_total_grad[1] += zu1b;
+            acc_total_grad[0] += zu0b;
             cp_termb += cp * w_termb;
-            v_sqr_normb = cp_termb / (2.0 * cp_term);
-            vel_total_grad(2) += w_term * w2b + 2 * v2 * v_sqr_normb + vel_grad(2);
-            vel_total_grad(1) += w_term * w1b + 2 * v1 * v_sqr_normb + vel_grad(1);
-            vel_total_grad(0) += w_term * w0b + 2 * v0 * v_sqr_normb + vel_grad(0);
-            pos_total_grad(2) = pos_grad(2);
-            pos_total_grad(1) = pos_grad(1);
-            pos_total_grad(0) = pos_grad(0);
+            v_sqr_normb = cp_termb / (2.0 * c.cp_term);
+            vel_total_grad[2] += c.w_term * w2b + 2.0 * c.v2 * v_sqr_normb + vel_grad[2];
+            vel_total_grad[1] += c.w_term * w1b + 2.0 * c.v1 * v_sqr_normb + vel_grad[1];
+            vel_total_grad[0] += c.w_term * w0b + 2.0 * c.v0 * v_sqr_normb + vel_grad[0];
+            pos_total_grad[2] = pos_grad[2];
+            pos_total_grad[1] = pos_grad[1];
+            pos_total_grad[0] = pos_grad[0];
 
             return;
         }
 
-    private:
-        double mass, grav, dh, dv, cp, veps;
-
-        double v0, v1, v2, a0, a1, a2, v_dot_a;
-        double z0, z1, z2, dz0, dz1, dz2;
-        double cp_term, w_term, dh_over_m;
-        double zu_sqr_norm, zu_norm, zu0, zu1, zu2;
-        double zu_sqr0, zu_sqr1, zu_sqr2, zu01, zu12, zu02;
-        double ng00, ng01, ng02, ng11, ng12, ng22, ng_den;
-        double dw_term, dz_term0, dz_term1, dz_term2, f_term0, f_term1, f_term2;
-        double tilt_den, tilt0, tilt1, tilt2, c_half_psi, s_half_psi;
-        double c_psi, s_psi, omg_den, omg_term;
+        double mass, grav, dh, dv, cp, veps, yeps;
+
+        FlatnessCache cache;
     };
 }
 
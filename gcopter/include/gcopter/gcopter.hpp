@@ -48,8 +48,26 @@ namespace gcopter
         typedef std::vector<PolyhedronH> PolyhedraH;
 
     private:
+        // Quadrature nodes of the penalty functional as structure-of-arrays
+        // buffers, one row per node, so that the flatness map runs over all
+        // nodes in batch. They are kept across evaluations to avoid allocation.
+        struct PenaltyNodes
+        {
+            Eigen::MatrixX3d pos, vel, acc, jer, sna;
+            Eigen::VectorXd thr;
+            Eigen::MatrixX4d quat;
+            Eigen::MatrixX3d omg;
+            Eigen::VectorXd gradThr;
+            Eigen::MatrixX4d gradQuat;
+            Eigen::MatrixX3d gradPos, gradVel, gradOmg, gradAcc;
+            Eigen::MatrixX3d totalGradPos, totalGradVel, totalGradAcc, totalGradJer;
+            Eigen::VectorXd pena;
+            flatness::FlatnessTape tape;
+        };
+
         minco::MINCO_S3NU minco;
         flatness::FlatnessMap flatmap;
+        PenaltyNodes penaNodes;
 
         double rho;
         Eigen::Matrix3d headPVA;
@@ -77,6 +95,8 @@ namespace gcopter
         double allocSpeed;
 
         lbfgs::lbfgs_parameter_t lbfgs_params;
+        bool directT;
+        bool velYaw;
 
         Eigen::Matrix3Xd points;
         Eigen::VectorXd times;
@@ -84,6 +104,7 @@ namespace gcopter
         Eigen::VectorXd gradByTimes;
         Eigen::MatrixX3d partialGradByCoeffs;
         Eigen::VectorXd partialGradByTimes;
+        Eigen::VectorXd precondDiag;
 
     private:
         static inline void forwardT(const Eigen::VectorXd &tau,
@@ -319,10 +340,16 @@ namespace gcopter
             }
         }
 
-        // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max]^T
-        // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, thrust_weight]^T
+        // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max, pitch_max,
+        //                    (fov_half_angle, fov_lookahead)]^T
+        // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, pitch_weight,
+        //                   thrust_weight, (fov_weight)]^T
         // physicalParams = [vehicle_mass, gravitational_acceleration, horitonral_drag_coeff,
         //                   vertical_drag_coeff, parasitic_drag_coeff, speed_smooth_factor]^T
+        // The optional FOV penalty keeps the chord to the position predicted
+        // fov_lookahead ahead, i.e., vel * tau + acc * tau^2 / 2, inside the cone of
+        // fov_half_angle around the body x axis, so that the near-future path
+        // stays in view of a forward-looking camera
         static inline void attachPenaltyFunctional(const Eigen::VectorXd &T,
                                                    const Eigen::MatrixX3d &coeffs,
                                                    const Eigen::VectorXi &hIdx,
@@ -331,7 +358,9 @@ namespace gcopter
                                                    const int &integralResolution,
                                                    const Eigen::VectorXd &magnitudeBounds,
                                                    const Eigen::VectorXd &penaltyWeights,
-                                                   flatness::FlatnessMap &flatMap,
+                                                   const bool &velocityYaw,
+                                                   const flatness::FlatnessMap &flatMap,
+                                                   PenaltyNodes &nodes,
                                                    double &cost,
                                                    Eigen::VectorXd &gradT,
                                                    Eigen::MatrixX3d &gradC)
@@ -351,9 +380,17 @@ namespace gcopter
             const double weightPitch = penaltyWeights(4);
             const double weightThrust = penaltyWeights(5);
 
+            const bool fovPenalty = penaltyWeights.size() > 6 && magnitudeBounds.size() > 7 &&
+                                    penaltyWeights(6) > 0.0;
+            const double weightFov = fovPenalty ? penaltyWeights(6) : 0.0;
+            const double cosFovMax = fovPenalty ? cos(magnitudeBounds(6)) : 1.0;
+            const double fovTau = fovPenalty ? magnitudeBounds(7) : 0.0;
+            const double fovHalfTauSqr = 0.5 * fovTau * fovTau;
+            Eigen::Vector3d chord, head, gradChord;
+            double chordNorm, violaFov, violaFovPena, violaFovPenaD;
+
             Eigen::Vector3d pos, vel, acc, jer, sna;
             Eigen::Vector3d totalGradPos, totalGradVel, totalGradAcc, totalGradJer;
-            double totalGradPsi, totalGradPsiD;
             double thr, cos_theta, pitch, sin_pitch;
             Eigen::Vector4d quat;
             Eigen::Vector3d omg;
@@ -378,11 +415,29 @@ namespace gcopter
             double node, pena;
 
             const int pieceNum = T.size();
+            const int nodeNum = integralResolution + 1;
             const double integralFrac = 1.0 / integralResolution;
+
+            nodes.pos.resize(nodeNum, 3);
+            nodes.vel.resize(nodeNum, 3);
+            nodes.acc.resize(nodeNum, 3);
+            nodes.jer.resize(nodeNum, 3);
+            nodes.sna.resize(nodeNum, 3);
+            nodes.gradThr.resize(nodeNum);
+            nodes.gradQuat.resize(nodeNum, 4);
+            nodes.gradPos.resize(nodeNum, 3);
+            nodes.gradVel.resize(nodeNum, 3);
+            nodes.gradOmg.resize(nodeNum, 3);
+            nodes.gradAcc.resize(nodeNum, 3);
+            nodes.pena.resize(nodeNum);
             for (int i = 0; i < pieceNum; i++)
             {
                 const Eigen::Matrix<double, 6, 3> &c = coeffs.block<6, 3>(i * 6, 0);
                 step = T(i) * integralFrac;
+                L = hIdx(i);
+                K = hPolys[L].rows();
+
+                // Sample the flat outputs at the nodes of this piece
                 for (int j = 0; j <= integralResolution; j++)
                 {
                     s1 = j * step;
@@ -395,21 +450,41 @@ namespace gcopter
                     beta2(0) = 0.0, beta2(1) = 0.0, beta2(2) = 2.0, beta2(3) = 6.0 * s1, beta2(4) = 12.0 * s2, beta2(5) = 20.0 * s3;
                     beta3(0) = 0.0, beta3(1) = 0.0, beta3(2) = 0.0, beta3(3) = 6.0, beta3(4) = 24.0 * s1, beta3(5) = 60.0 * s2;
                     beta4(0) = 0.0, beta4(1) = 0.0, beta4(2) = 0.0, beta4(3) = 0.0, beta4(4) = 24.0, beta4(5) = 120.0 * s1;
-                    pos = c.transpose() * beta0;
-                    vel = c.transpose() * beta1;
-                    acc = c.transpose() * beta2;
-                    jer = c.transpose() * beta3;
-                    sna = c.transpose() * beta4;
+                    nodes.pos.row(j) = beta0.transpose() * c;
+                    nodes.vel.row(j) = beta1.transpose() * c;
+                    nodes.acc.row(j) = beta2.transpose() * c;
+                    nodes.jer.row(j) = beta3.transpose() * c;
+                    nodes.sna.row(j) = beta4.transpose() * c;
+                }
+
+                if (velocityYaw)
+                {
+                    flatMap.forwardVelYawSmoothBatch(nodes.vel, nodes.acc, nodes.jer,
+                                                     nodes.thr, nodes.quat, nodes.omg, nodes.tape);
+                }
+                else
+                {
+                    flatMap.forwardBatch(nodes.vel, nodes.acc, nodes.jer,
+                                         nodes.thr, nodes.quat, nodes.omg, nodes.tape);
+                }
 
-                    flatMap.forward(vel, acc, jer, 0.0, 0.0, thr, quat, omg);
+                // Penalties and their gradients w.r.t. the outputs of the flatness map
+                for (int j = 0; j <= integralResolution; j++)
+                {
+                    pos = nodes.pos.row(j).transpose();
+                    vel = nodes.vel.row(j).transpose();
+                    acc = nodes.acc.row(j).transpose();
+                    thr = nodes.thr(j);
+                    quat = nodes.quat.row(j).transpose();
+                    omg = nodes.omg.row(j).transpose();
 
                     violaVel = vel.squaredNorm() - velSqrMax;
                     violaOmg = omg.squaredNorm() - omgSqrMax;
                     cos_theta = 1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2));
-                    violaTheta = acos(cos_theta) - thetaMax;
+                    violaTheta = flatness::fastAcos(cos_theta) - thetaMax;
                     //Joeyyu: Pitch viola
                     sin_pitch = 2.0*(quat(0)*quat(2)-quat(3)*quat(1));
-                    pitch = asin(sin_pitch);
+                    pitch = flatness::fastAsin(sin_pitch);
                     
                     violaPitch = pitch*pitch - pitchMax*pitchMax;
 
@@ -420,8 +495,6 @@ namespace gcopter
                     gradPos.setZero(), gradVel.setZero(), gradOmg.setZero();
                     pena = 0.0;
 
-                    L = hIdx(i);
-                    K = hPolys[L].rows();
                     for (int k = 0; k < K; k++)
                     {
                         outerNormal = hPolys[L].block<1, 3>(k, 0);
@@ -471,9 +544,78 @@ namespace gcopter
                         pena += weightThrust * violaThrustPena;
                     }
 
-                    flatMap.backward(gradPos, gradVel, gradThr, gradQuat, gradOmg,
-                                     totalGradPos, totalGradVel, totalGradAcc, totalGradJer,
-                                     totalGradPsi, totalGradPsiD);
+                    gradChord.setZero();
+                    if (fovPenalty)
+                    {
+                        // cos_max * |d| - head . d is used instead of the angle, whose
+                        // gradient is bounded even when the chord d vanishes at hover
+                        chord = fovTau * vel + fovHalfTauSqr * acc;
+                        chordNorm = chord.norm();
+                        // body x axis of quat = [w, x, y, z]^T
+                        head(0) = 1.0 - 2.0 * (quat(2) * quat(2) + quat(3) * quat(3));
+                        head(1) = 2.0 * (quat(1) * quat(2) + quat(0) * quat(3));
+                        head(2) = 2.0 * (quat(1) * quat(3) - quat(0) * quat(2));
+                        violaFov = cosFovMax * chordNorm - head.dot(chord);
+                        if (chordNorm > DBL_EPSILON &&
+                            smoothedL1(violaFov, smoothFactor, violaFovPena, violaFovPenaD))
+                        {
+                            gradQuat -= weightFov * violaFovPenaD * 2.0 *
+                                        Eigen::Vector4d(quat(3) * chord(1) - quat(2) * chord(2),
+                                                        quat(2) * chord(1) + quat(3) * chord(2),
+                                                        quat(1) * chord(1) - quat(0) * chord(2) - 2.0 * quat(2) * chord(0),
+                                                        quat(0) * chord(1) + quat(1) * chord(2) - 2.0 * quat(3) * chord(0));
+                            gradChord = weightFov * violaFovPenaD * (cosFovMax / chordNorm * chord - head);
+                            gradVel += fovTau * gradChord;
+                            pena += weightFov * violaFovPena;
+                        }
+                    }
+
+                    nodes.gradThr(j) = gradThr;
+                    nodes.gradQuat.row(j) = gradQuat.transpose();
+                    nodes.gradPos.row(j) = gradPos.transpose();
+                    nodes.gradVel.row(j) = gradVel.transpose();
+                    nodes.gradOmg.row(j) = gradOmg.transpose();
+                    nodes.gradAcc.row(j) = fovHalfTauSqr * gradChord.transpose();
+                    nodes.pena(j) = pena;
+                }
+
+                if (velocityYaw)
+                {
+                    flatMap.backwardVelYawBatch(nodes.gradPos, nodes.gradVel, nodes.gradThr,
+                                                nodes.gradQuat, nodes.gradOmg,
+                                                nodes.totalGradPos, nodes.totalGradVel,
+                                                nodes.totalGradAcc, nodes.totalGradJer, nodes.tape);
+                }
+                else
+                {
+                    flatMap.backwardBatch(nodes.gradPos, nodes.gradVel, nodes.gradThr,
+                                          nodes.gradQuat, nodes.gradOmg,
+                                          nodes.totalGradPos, nodes.totalGradVel,
+                                          nodes.totalGradAcc, nodes.totalGradJer, nodes.tape);
+                }
+                nodes.totalGradAcc += nodes.gradAcc;
+
+                // Trapezoidal quadrature of the penalties and their gradients
+                for (int j = 0; j <= integralResolution; j++)
+                {
+                    s1 = j * step;
+                    s2 = s1 * s1;
+                    s3 = s2 * s1;
+                    s4 = s2 * s2;
+                    s5 = s4 * s1;
+                    beta0(0) = 1.0, beta0(1) = s1, beta0(2) = s2, beta0(3) = s3, beta0(4) = s4, beta0(5) = s5;
+                    beta1(0) = 0.0, beta1(1) = 1.0, beta1(2) = 2.0 * s1, beta1(3) = 3.0 * s2, beta1(4) = 4.0 * s3, beta1(5) = 5.0 * s4;
+                    beta2(0) = 0.0, beta2(1) = 0.0, beta2(2) = 2.0, beta2(3) = 6.0 * s1, beta2(4) = 12.0 * s2, beta2(5) = 20.0 * s3;
+                    beta3(0) = 0.0, beta3(1) = 0.0, beta3(2) = 0.0, beta3(3) = 6.0, beta3(4) = 24.0 * s1, beta3(5) = 60.0 * s2;
+                    totalGradPos = nodes.totalGradPos.row(j).transpose();
+                    totalGradVel = nodes.totalGradVel.row(j).transpose();
+                    totalGradAcc = nodes.totalGradAcc.row(j).transpose();
+                    totalGradJer = nodes.totalGradJer.row(j).transpose();
+                    vel = nodes.vel.row(j).transpose();
+                    acc = nodes.acc.row(j).transpose();
+                    jer = nodes.jer.row(j).transpose();
+                    sna = nodes.sna.row(j).transpose();
+                    pena = nodes.pena(j);
 
                     node = (j == 0 || j == integralResolution) ? 0.5 : 1.0;
                     alpha = j * integralFrac;
@@ -508,7 +650,15 @@ namespace gcopter
             Eigen::Map<Eigen::VectorXd> gradTau(g.data(), dimTau);
             Eigen::Map<Eigen::VectorXd> gradXi(g.data() + dimTau, dimXi);
 
-            forwardT(tau, obj.times);
+            // tau is exactly T in directT mode, where T is bounded by the solver
+            if (obj.directT)
+            {
+                obj.times = tau;
+            }
+            else
+            {
+                forwardT(tau, obj.times);
+            }
             forwardP(xi, obj.vPolyIdx, obj.vPolytopes, obj.points);
 
             double cost;
@@ -520,7 +670,7 @@ namespace gcopter
             attachPenaltyFunctional(obj.times, obj.minco.getCoeffs(),
                                     obj.hPolyIdx, obj.hPolytopes,
                                     obj.smoothEps, obj.integralRes,
-                                    obj.magnitudeBd, obj.penaltyWt, obj.flatmap,
+                                    obj.magnitudeBd, obj.penaltyWt, obj.velYaw, obj.flatmap, obj.penaNodes,
                                     cost, obj.partialGradByTimes, obj.partialGradByCoeffs);
 
             obj.minco.propogateGrad(obj.partialGradByCoeffs, obj.partialGradByTimes,
@@ -529,13 +679,80 @@ namespace gcopter
             cost += weightT * obj.times.sum();
             obj.gradByTimes.array() += weightT;
 
-            backwardGradT(tau, obj.gradByTimes, gradTau);
+            if (obj.directT)
+            {
+                gradTau = obj.gradByTimes;
+            }
+            else
+            {
+                backwardGradT(tau, obj.gradByTimes, gradTau);
+            }
             backwardGradP(xi, obj.vPolyIdx, obj.vPolytopes, obj.gradByPoints, gradXi);
             normRetrictionLayer(xi, obj.vPolyIdx, obj.vPolytopes, cost, gradXi);
 
             return cost;
         }
 
+        static inline void precondFunctional(void *ptr,
+                                             Eigen::VectorXd &v)
+        {
+            GCOPTER_PolytopeSFC &obj = *(GCOPTER_PolytopeSFC *)ptr;
+            v.array() *= obj.precondDiag.array();
+
+            return;
+        }
+
+        // The diagonal preconditioner approximates the inverse hessian in the
+        // decision variables [tau, xi] by rescaling each of them to a relative
+        // change of its piece duration or its piece length, where tau = T if directTau
+        static inline void getPreconditioner(const Eigen::VectorXd &tau,
+                                             const Eigen::VectorXd &T,
+                                             const Eigen::Matrix3Xd &P,
+                                             const Eigen::Vector3d &ini,
+                                             const Eigen::Vector3d &fin,
+                                             const Eigen::VectorXi &vIdx,
+                                             const PolyhedraV &vPolys,
+                                             const bool &directTau,
+                                             Eigen::VectorXd &diag)
+        {
+            const int sizeT = T.size();
+            const int sizeP = P.cols();
+
+            if (directTau)
+            {
+                diag.head(sizeT) = T.cwiseAbs2();
+            }
+            else
+            {
+                Eigen::VectorXd dTdTau;
+                backwardGradT(tau, Eigen::VectorXd::Ones(sizeT), dTdTau);
+                diag.head(sizeT) = T.cwiseQuotient(dTdTau).cwiseAbs2();
+            }
+
+            Eigen::VectorXd lengths(sizeT);
+            for (int i = 0; i < sizeT; i++)
+            {
+                lengths(i) = ((i < sizeP ? P.col(i) : fin) -
+                              (i > 0 ? P.col(i - 1) : ini))
+                                 .norm();
+            }
+
+            double polySize, pieceLength;
+            for (int i = 0, j = sizeT, k, l; i < sizeP; i++, j += k)
+            {
+                l = vIdx(i);
+                k = vPolys[l].cols();
+                polySize = vPolys[l].rightCols(k - 1).colwise().norm().maxCoeff();
+                pieceLength = 0.5 * (lengths(i) + lengths(i + 1));
+                diag.segment(j, k).setConstant(pieceLength * pieceLength /
+                                               std::max(polySize * polySize, DBL_EPSILON));
+            }
+
+            diag /= diag.maxCoeff();
+
+            return;
+        }
+
         static inline double costDistance(void *ptr,
                                           const Eigen::VectorXd &xi,
                                           Eigen::VectorXd &gradXi)
@@ -747,10 +964,14 @@ namespace gcopter
         }
 
     public:
-        // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max]^T
-        // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, thrust_weight]^T
+        // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max, pitch_max,
+        //                    (fov_half_angle, fov_lookahead)]^T
+        // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, pitch_weight,
+        //                   thrust_weight, (fov_weight)]^T
         // physicalParams = [vehicle_mass, gravitational_acceleration, horitonral_drag_coeff,
         //                   vertical_drag_coeff, parasitic_drag_coeff, speed_smooth_factor]^T
+        // velocityYaw = true evaluates the attitude penalties with the yaw aligned to
+        // the horizontal velocity (FlatnessMap::forwardVelYawSmooth), instead of zero yaw
         inline bool setup(const double &timeWeight,
                           const Eigen::Matrix3d &initialPVA,
                           const Eigen::Matrix3d &terminalPVA,
@@ -760,9 +981,11 @@ namespace gcopter
                           const int &integralResolution,
                           const Eigen::VectorXd &magnitudeBounds,
                           const Eigen::VectorXd &penaltyWeights,
-                          const Eigen::VectorXd &physicalParams)
+                          const Eigen::VectorXd &physicalParams,
+                          const bool &velocityYaw = false)
         {
             rho = timeWeight;
+            velYaw = velocityYaw;
             headPVA = initialPVA;
             tailPVA = terminalPVA;
 
@@ -832,17 +1055,38 @@ namespace gcopter
             return true;
         }
 
+        // secondOrder = true switches L-BFGS to the truncated Newton (Newton-CG)
+        // solver, which pays more evaluations per iteration for fewer iterations
+        // when a high accuracy, i.e., a tiny relCostTol, is required offline
+        // directTime = true optimizes durations T directly with lower bounds by
+        // the projected L-BFGS instead of the diffeomorphism T(tau), which is
+        // exclusive with secondOrder
         inline double optimize(Trajectory<5> &traj,
-                               const double &relCostTol)
+                               const double &relCostTol,
+                               const bool &secondOrder = false,
+                               const bool &directTime = false)
         {
             Eigen::VectorXd x(temporalDim + spatialDim);
             Eigen::Map<Eigen::VectorXd> tau(x.data(), temporalDim);
             Eigen::Map<Eigen::VectorXd> xi(x.data() + temporalDim, spatialDim);
 
+            directT = directTime;
             setInitial(shortPath, allocSpeed, pieceIdx, points, times);
-            backwardT(times, tau);
+            if (directT)
+            {
+                tau = times;
+            }
+            else
+            {
+                backwardT(times, tau);
+            }
             backwardP(points, vPolyIdx, vPolytopes, xi);
 
+            precondDiag.resize(temporalDim + spatialDim);
+            getPreconditioner(tau, times, points,
+                              headPVA.col(0), tailPVA.col(0),
+                              vPolyIdx, vPolytopes, directT, precondDiag);
+
             double minCostFunctional;
             lbfgs_params.mem_size = 256;
             lbfgs_params.past = 3;
@@ -850,17 +1094,59 @@ namespace gcopter
             lbfgs_params.g_epsilon = 0.0;
             lbfgs_params.delta = relCostTol;
 
-            int ret = lbfgs::lbfgs_optimize(x,
+            int ret;
+            if (directT)
+            {
+                // durations are kept away from zero where MINCO degenerates
+                Eigen::VectorXd lowerBd(temporalDim + spatialDim);
+                Eigen::VectorXd upperBd(temporalDim + spatialDim);
+                lowerBd.head(temporalDim).setConstant(1.0e-3 * times.minCoeff());
+                lowerBd.tail(spatialDim).setConstant(-INFINITY);
+                upperBd.setConstant(INFINITY);
+                ret = lbfgs::projected_lbfgs_optimize(x,
+                                                      minCostFunctional,
+                                                      lowerBd,
+                                                      upperBd,
+                                                      &GCOPTER_PolytopeSFC::costFunctional,
+                                                      nullptr,
+                                                      nullptr,
+                                                      &GCOPTER_PolytopeSFC::precondFunctional,
+                                                      this,
+                                                      lbfgs_params);
+            }
+            else if (secondOrder)
+            {
+                ret = lbfgs::newton_cg_optimize(x,
+                                                minCostFunctional,
+                                                &GCOPTER_PolytopeSFC::costFunctional,
+                                                nullptr,
+                                                nullptr,
+                                                &GCOPTER_PolytopeSFC::precondFunctional,
+                                                this,
+                                                lbfgs_params);
+            }
+            else
+            {
+                ret = lbfgs::lbfgs_optimize(x,
                                             minCostFunctional,
                                             &GCOPTER_PolytopeSFC::costFunctional,
                                             nullptr,
                                             nullptr,
+                                            &GCOPTER_PolytopeSFC::precondFunctional,
                                             this,
                                             lbfgs_params);
+            }
 
             if (ret >= 0)
             {
-                forwardT(tau, times);
+                if (directT)
+                {
+                    times = tau;
+                }
+                else
+                {
+                    forwardT(tau, times);
+                }
                 forwardP(xi, vPolyIdx, vPolytopes, points);
                 minco.setParameters(points, times);
                 minco.getTrajectory(traj);
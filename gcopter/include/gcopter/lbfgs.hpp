@@ -4,11 +4,26 @@
 #include <Eigen/Eigen>
 #include <cmath>
 #include <algorithm>
+#include <istream>
+#include <ostream>
 
 namespace lbfgs
 {
     // ----------------------- Data Type Part -----------------------
 
+    /**
+     * Line search methods for lbfgs_parameter_t::line_search_type.
+     */
+    enum
+    {
+        /** The Lewis-Overton line search for the weak Wolfe conditions. */
+        LBFGS_LINESEARCH_LEWISOVERTON = 0,
+        /** The More-Thuente line search for the strong Wolfe conditions. */
+        LBFGS_LINESEARCH_MORETHUENTE,
+        /** The Zhang-Hager nonmonotone line search for the weak Wolfe conditions. */
+        LBFGS_LINESEARCH_ZHANGHAGER,
+    };
+
     /**
      * L-BFGS optimization parameters.
      */
@@ -76,6 +91,31 @@ namespace lbfgs
         //int max_linesearch = 64;
         int max_linesearch = 256;
 
+        /**
+         * The line search method.
+         *  LBFGS_LINESEARCH_LEWISOVERTON bisects and extrapolates a bracket
+         *  until the weak Wolfe conditions hold, which also applies to
+         *  piecewise smooth functions. LBFGS_LINESEARCH_MORETHUENTE uses
+         *  safeguarded cubic and quadratic interpolation for the strong
+         *  Wolfe conditions, which usually needs fewer trials on smooth
+         *  functions. LBFGS_LINESEARCH_ZHANGHAGER checks the Armijo condition
+         *  against an averaged past cost instead of the current one, which
+         *  accepts the initial trial step more often. The default value is
+         *  LBFGS_LINESEARCH_LEWISOVERTON.
+         */
+        int line_search_type = LBFGS_LINESEARCH_LEWISOVERTON;
+
+        /**
+         * The decay factor of the nonmonotone reference cost.
+         *  This parameter is only used by LBFGS_LINESEARCH_ZHANGHAGER. The
+         *  reference cost is a weighted average of all past costs, where the
+         *  weights decay geometrically with this factor. Zero recovers the
+         *  monotone line search, while a value close to 1.0 is the most
+         *  nonmonotone one. The default value is 0.85. This parameter should
+         *  be in [0.0, 1.0].
+         */
+        double nonmonotone_decay = 0.85;
+
         /**
          * The minimum step of the line search routine.
          *  The default value is 1.0e-20. This value need not be modified unless
@@ -127,6 +167,16 @@ namespace lbfgs
          *  estimate the machine precision.
          */
         double machine_prec = 1.0e-16;
+
+        /**
+         * The maximum number of conjugate gradient iterations per step.
+         *  This parameter is only used by newton_cg_optimize(). Each conjugate
+         *  gradient iteration costs one more gradient evaluation for the
+         *  finite-difference hessian-vector product. Setting this parameter to
+         *  zero bounds the iterations by the number of variables only.
+         *  The default value is 0.
+         */
+        int max_cg_iterations = 0;
     };
 
     /**
@@ -141,6 +191,8 @@ namespace lbfgs
         LBFGS_STOP,
         /** The iteration has been canceled by the monitor callback. */
         LBFGS_CANCELED,
+        /** The minimization is unfinished, only returned by lbfgs_solver. */
+        LBFGS_RUNNING,
 
         /** Unknown error. */
         LBFGSERR_UNKNOWNERROR = -1024,
@@ -182,6 +234,14 @@ namespace lbfgs
         LBFGSERR_INVALIDPARAMETERS,
         /** The current search direction increases the cost function value. */
         LBFGSERR_INCREASEGRADIENT,
+        /** Invalid parameter lbfgs_parameter_t::line_search_type specified. */
+        LBFGSERR_INVALID_LINESEARCH,
+        /** Invalid parameter lbfgs_parameter_t::nonmonotone_decay specified. */
+        LBFGSERR_INVALID_NONMONOTONEDECAY,
+        /** Rounding errors prevent further progress of the line search. */
+        LBFGSERR_ROUNDINGERROR,
+        /** Invalid lower or upper bounds of variables specified. */
+        LBFGSERR_INVALID_BOUNDS,
     };
 
     /**
@@ -248,6 +308,23 @@ namespace lbfgs
                                     const int k,
                                     const int ls);
 
+    /**
+     * Callback interface to apply a preconditioner to a vector.
+     *
+     *  The lbfgs_optimize() function call this function to multiply a vector by
+     *  a symmetric positive definite matrix M in place, where M approximates the
+     *  inverse hessian matrix up to a scalar. The initial hessian matrix H_0 is
+     *  then assumed as (y^t \cdot s) / (y^t \cdot M \cdot y) * M instead of the
+     *  scaled identity matrix. A diagonal or a cheap block-diagonal M is expected.
+     *  M should remain unchanged during a minimization process. If it is not used,
+     *  just set it nullptr.
+     *
+     *  @param  instance    The user data sent for lbfgs_optimize() function by the client.
+     *  @param  v           The vector to be preconditioned, i.e., v <- M \cdot v.
+     */
+    typedef void (*lbfgs_precondition_t)(void *instance,
+                                         Eigen::VectorXd &v);
+
     /**
      * Callback data struct
      */
@@ -257,6 +334,7 @@ namespace lbfgs
         lbfgs_evaluate_t proc_evaluate = nullptr;
         lbfgs_stepbound_t proc_stepbound = nullptr;
         lbfgs_progress_t proc_progress = nullptr;
+        lbfgs_precondition_t proc_precondition = nullptr;
     };
 
     // ----------------------- L-BFGS Part -----------------------
@@ -385,202 +463,1732 @@ namespace lbfgs
     }
 
     /**
-     * Start a L-BFGS optimization.
-     * Assumptions: 1. f(x) is either C2 or C0 but piecewise C2;
-     *              2. f(x) is lower bounded;
-     *              3. f(x) has bounded level sets;
-     *              4. g(x) is either the gradient or subgradient;
-     *              5. The gradient exists at the initial guess x0.
-     * A user must implement a function compatible with ::lbfgs_evaluate_t (evaluation
-     * callback) and pass the pointer to the callback function to lbfgs_optimize() 
-     * arguments. Similarly, a user can implement a function compatible with 
-     * ::lbfgs_stepbound_t to provide an external upper bound for stepsize, and 
-     * ::lbfgs_progress_t (progress callback) to obtain the current progress 
-     * (e.g., variables, function, and gradient, etc) and to cancel the iteration 
-     * process if necessary. Implementation of the stepbound and the progress callback 
-     * is optional: a user can pass nullptr if progress notification is not necessary.
-     * 
+     * Nonmonotone line search for smooth or nonsmooth functions.
+     *  This function performs the Lewis-Overton line search, where the
+     *  Armijo condition is checked against the reference cost fref,
+     *  i.e., a weighted average of past costs, instead of the cost at xp.
+     *  The weak Wolfe condition is kept such that y^t \cdot s > 0 still
+     *  holds for the quasi-Newton update.
      *
-     *  @param  x               The vector of decision variables.
-     *                          THE INITIAL GUESS x0 SHOULD BE SET BEFORE THE CALL!
-     *                          A client program can receive decision variables 
-     *                          through this vector, at which the cost and its 
-     *                          gradient are queried during minimization.
-     *  @param  f               The ref to the variable that receives the final
-     *                          value of the cost function for the variables.
-     *  @param  proc_evaluate   The callback function to provide function f(x) and
-     *                          gradient g(x) evaluations given a current values of
-     *                          variables x. A client program must implement a
-     *                          callback function compatible with lbfgs_evaluate_t 
-     *                          and pass the pointer to the callback function.
-     *  @param  proc_stepbound  The callback function to provide values of the
-     *                          upperbound of the stepsize to search in, provided
-     *                          with the beginning values of variables before the 
-     *                          line search, and the current step vector (can be 
-     *                          negative gradient). A client program can implement
-     *                          this function for more efficient linesearch. If it is
-     *                          not used, just set it nullptr.
-     *  @param  proc_progress   The callback function to receive the progress
-     *                          (the number of iterations, the current value of
-     *                          the cost function) of the minimization
-     *                          process. This argument can be set to nullptr if
-     *                          a progress report is unnecessary.
-     *  @param  instance        A user data pointer for client programs. The callback
-     *                          functions will receive the value of this argument.
-     *  @param  param           The parameters for L-BFGS optimization.
-     *  @retval int             The status code. This function returns a nonnegative 
-     *                          integer if the minimization process terminates without 
-     *                          an error. A negative integer indicates an error.
+     *  @see
+     *      Hongchao Zhang and William W. Hager. A nonmonotone line search 
+     *      technique and its application to unconstrained optimization. 
+     *      SIAM Journal on Optimization, Vol 14, No 4, pp. 1043-1056, 2004.
      */
-    inline int lbfgs_optimize(Eigen::VectorXd &x,
-                              double &f,
-                              lbfgs_evaluate_t proc_evaluate,
-                              lbfgs_stepbound_t proc_stepbound,
-                              lbfgs_progress_t proc_progress,
-                              void *instance,
-                              const lbfgs_parameter_t &param)
+    inline int line_search_zhanghager(Eigen::VectorXd &x,
+                                      double &f,
+                                      Eigen::VectorXd &g,
+                                      double &stp,
+                                      const Eigen::VectorXd &s,
+                                      const Eigen::VectorXd &xp,
+                                      const Eigen::VectorXd &gp,
+                                      const double stpmin,
+                                      const double stpmax,
+                                      const double fref,
+                                      const callback_data_t &cd,
+                                      const lbfgs_parameter_t &param)
     {
-        int ret, i, j, k, ls, end, bound;
-        double step, step_min, step_max, fx, ys, yy;
-        double gnorm_inf, xnorm_inf, beta, rate, cau;
+        /* The initial cost only serves as the Armijo reference in Lewis-Overton. */
+        f = std::max(f, fref);
+        return line_search_lewisoverton(x, f, g, stp, s, xp, gp, stpmin, stpmax, cd, param);
+    }
 
-        const int n = x.size();
-        const int m = param.mem_size;
+    /**
+     * Find a minimizer of an interpolated cubic function.
+     *  @param  u       The value of one point, u.
+     *  @param  fu      The value of f(u).
+     *  @param  du      The value of f'(u).
+     *  @param  v       The value of another point, v.
+     *  @param  fv      The value of f(v).
+     *  @param  dv      The value of f'(v).
+     *  @retval double  The minimizer.
+     */
+    inline double cubic_minimizer(const double u, const double fu, const double du,
+                                  const double v, const double fv, const double dv)
+    {
+        const double d = v - u;
+        const double theta = (fu - fv) * 3.0 / d + du + dv;
+        const double s = std::max(std::fabs(theta), std::max(std::fabs(du), std::fabs(dv)));
+        const double a = theta / s;
+        double gamma = s * std::sqrt(a * a - (du / s) * (dv / s));
+        if (v < u)
+        {
+            gamma = -gamma;
+        }
+        const double p = gamma - du + theta;
+        const double q = gamma - du + gamma + dv;
+        return u + p / q * d;
+    }
 
-        /* Check the input parameters for errors. */
-        if (n <= 0)
+    /**
+     * Find a minimizer of an interpolated cubic function, where the minimizer
+     *  is safeguarded by [xmin, xmax] when the cubic tends to infinity in the
+     *  direction of the step.
+     */
+    inline double cubic_minimizer2(const double u, const double fu, const double du,
+                                   const double v, const double fv, const double dv,
+                                   const double xmin, const double xmax)
+    {
+        const double d = v - u;
+        const double theta = (fu - fv) * 3.0 / d + du + dv;
+        const double s = std::max(std::fabs(theta), std::max(std::fabs(du), std::fabs(dv)));
+        const double a = theta / s;
+        double gamma = s * std::sqrt(std::max(0.0, a * a - (du / s) * (dv / s)));
+        if (u < v)
         {
-            return LBFGSERR_INVALID_N;
+            gamma = -gamma;
         }
-        if (m <= 0)
+        const double p = gamma - dv + theta;
+        const double q = gamma - dv + gamma + du;
+        const double r = p / q;
+        if (r < 0.0 && gamma != 0.0)
         {
-            return LBFGSERR_INVALID_MEMSIZE;
+            return v - r * d;
         }
-        if (param.g_epsilon < 0.0)
+        else if (a < 0.0)
         {
-            return LBFGSERR_INVALID_GEPSILON;
+            return xmax;
         }
-        if (param.past < 0)
+        else
         {
-            return LBFGSERR_INVALID_TESTPERIOD;
+            return xmin;
         }
-        if (param.delta < 0.0)
+    }
+
+    /**
+     * Find a minimizer of an interpolated quadratic function from
+     *  f(u), f'(u), and f(v).
+     */
+    inline double quard_minimizer(const double u, const double fu, const double du,
+                                  const double v, const double fv)
+    {
+        const double a = v - u;
+        return u + du / ((fu - fv) / a + du) / 2.0 * a;
+    }
+
+    /**
+     * Find a minimizer of an interpolated quadratic function from
+     *  f'(u) and f'(v).
+     */
+    inline double quard_minimizer2(const double u, const double du,
+                                   const double v, const double dv)
+    {
+        const double a = u - v;
+        return v + dv / (dv - du) * a;
+    }
+
+    /**
+     * Update a safeguarded trial value and interval for line search.
+     *
+     *  The parameter x represents the step with the least function value.
+     *  The parameter t represents the current step. This function assumes
+     *  that the derivative at the point of x in the direction of the step.
+     *  If the bracket is set to true, the minimizer has been bracketed in
+     *  an interval of uncertainty with endpoints between x and y.
+     *
+     *  @param  x       The value of one endpoint.
+     *  @param  fx      The value of f(x).
+     *  @param  dx      The value of f'(x).
+     *  @param  y       The value of another endpoint.
+     *  @param  fy      The value of f(y).
+     *  @param  dy      The value of f'(y).
+     *  @param  t       The value of the trial value, t.
+     *  @param  ft      The value of f(t).
+     *  @param  dt      The value of f'(t).
+     *  @param  tmin    The minimum value for the trial value, t.
+     *  @param  tmax    The maximum value for the trial value, t.
+     *  @param  brackt  The predicate if the trial value is bracketed.
+     *  @retval int     Zero if the trial value is updated, otherwise
+     *                  the interval is found inconsistent due to rounding.
+     *
+     *  @see
+     *      Jorge J. More and David J. Thuente. Line search algorithm with
+     *      guaranteed sufficient decrease. ACM Transactions on Mathematical
+     *      Software (TOMS), Vol 20, No 3, pp. 286-307, 1994.
+     */
+    inline int update_trial_interval(double &x, double &fx, double &dx,
+                                     double &y, double &fy, double &dy,
+                                     double &t, const double ft, const double dt,
+                                     const double tmin, const double tmax,
+                                     bool &brackt)
+    {
+        bool bound;
+        const bool dsign = (dt < 0.0) != (dx < 0.0);
+        double mc, mq, newt;
+
+        /* Check the input parameters for errors. */
+        if (brackt)
         {
-            return LBFGSERR_INVALID_DELTA;
+            if (t <= std::min(x, y) || std::max(x, y) <= t ||
+                0.0 <= dx * (t - x) || tmax < tmin)
+            {
+                return 1;
+            }
         }
-        if (param.min_step < 0.0)
+
+        /*
+        Trial value selection.
+        */
+        if (fx < ft)
         {
-            return LBFGSERR_INVALID_MINSTEP;
+            /*
+            Case 1: a higher function value.
+            The minimum is brackt. If the cubic minimizer is closer
+            to x than the quadratic one, the cubic one is taken, else
+            the average of the minimizers is taken.
+            */
+            brackt = true;
+            bound = true;
+            mc = cubic_minimizer(x, fx, dx, t, ft, dt);
+            mq = quard_minimizer(x, fx, dx, t, ft);
+            if (std::fabs(mc - x) < std::fabs(mq - x))
+            {
+                newt = mc;
+            }
+            else
+            {
+                newt = mc + 0.5 * (mq - mc);
+            }
         }
-        if (param.max_step < param.min_step)
+        else if (dsign)
         {
-            return LBFGSERR_INVALID_MAXSTEP;
+            /*
+            Case 2: a lower function value and derivatives of
+            opposite sign. The minimum is brackt. If the cubic
+            minimizer is closer to x than the quadratic (secant) one,
+            the cubic one is taken, else the quadratic one is taken.
+            */
+            brackt = true;
+            bound = false;
+            mc = cubic_minimizer(x, fx, dx, t, ft, dt);
+            mq = quard_minimizer2(x, dx, t, dt);
+            if (std::fabs(mc - t) > std::fabs(mq - t))
+            {
+                newt = mc;
+            }
+            else
+            {
+                newt = mq;
+            }
         }
-        if (!(param.f_dec_coeff > 0.0 &&
-              param.f_dec_coeff < 1.0))
+        else if (std::fabs(dt) < std::fabs(dx))
         {
-            return LBFGSERR_INVALID_FDECCOEFF;
+            /*
+            Case 3: a lower function value, derivatives of the
+            same sign, and the magnitude of the derivative decreases.
+            The cubic minimizer is only used if the cubic tends to
+            infinity in the direction of the minimizer or if the minimum
+            of the cubic is beyond t. Otherwise the cubic minimizer is
+            defined to be either tmin or tmax. The quadratic (secant)
+            minimizer is also computed and if the minimum is brackt
+            then the the minimizer closest to x is taken, else the one
+            farthest away is taken.
+            */
+            bound = true;
+            mc = cubic_minimizer2(x, fx, dx, t, ft, dt, tmin, tmax);
+            mq = quard_minimizer2(x, dx, t, dt);
+            if (brackt)
+            {
+                newt = std::fabs(t - mc) < std::fabs(t - mq) ? mc : mq;
+            }
+            else
+            {
+                newt = std::fabs(t - mc) > std::fabs(t - mq) ? mc : mq;
+            }
         }
-        if (!(param.s_curv_coeff < 1.0 &&
-              param.s_curv_coeff > param.f_dec_coeff))
+        else
         {
-            return LBFGSERR_INVALID_SCURVCOEFF;
+            /*
+            Case 4: a lower function value, derivatives of the
+            same sign, and the magnitude of the derivative does
+            not decrease. If the minimum is not brackt, the step
+            is either tmin or tmax, else the cubic minimizer is taken.
+            */
+            bound = false;
+            if (brackt)
+            {
+                newt = cubic_minimizer(t, ft, dt, y, fy, dy);
+            }
+            else if (x < t)
+            {
+                newt = tmax;
+            }
+            else
+            {
+                newt = tmin;
+            }
         }
-        if (!(param.machine_prec > 0.0))
+
+        /*
+        Update the interval of uncertainty. This update does not
+        depend on the new step or the case analysis above.
+        */
+        if (fx < ft)
         {
-            return LBFGSERR_INVALID_MACHINEPREC;
+            /* Case a: y <- t. */
+            y = t;
+            fy = ft;
+            dy = dt;
         }
-        if (param.max_linesearch <= 0)
+        else
         {
-            return LBFGSERR_INVALID_MAXLINESEARCH;
+            /* Case c: y <- x. */
+            if (dsign)
+            {
+                y = x;
+                fy = fx;
+                dy = dx;
+            }
+            /* Case b and c: x <- t. */
+            x = t;
+            fx = ft;
+            dx = dt;
         }
 
-        /* Prepare intermediate variables. */
-        Eigen::VectorXd xp(n);
-        Eigen::VectorXd g(n);
-        Eigen::VectorXd gp(n);
-        Eigen::VectorXd d(n);
-        Eigen::VectorXd pf(std::max(1, param.past));
+        /* Clip the new trial value in [tmin, tmax]. */
+        newt = std::min(tmax, std::max(tmin, newt));
 
-        /* Initialize the limited memory. */
-        Eigen::VectorXd lm_alpha = Eigen::VectorXd::Zero(m);
-        Eigen::MatrixXd lm_s = Eigen::MatrixXd::Zero(n, m);
-        Eigen::MatrixXd lm_y = Eigen::MatrixXd::Zero(n, m);
-        Eigen::VectorXd lm_ys = Eigen::VectorXd::Zero(m);
+        /*
+        Redefine the new trial value if it is close to the upper bound
+        of the interval, or if it is too close to the lower bound, which
+        happens when f(y) is extremely large due to barrier-like costs.
+        */
+        if (brackt && bound)
+        {
+            mq = x + 0.66 * (y - x);
+            mc = x + 0.1 * (y - x);
+            newt = x < y ? std::max(mc, std::min(mq, newt))
+                         : std::min(mc, std::max(mq, newt));
+        }
 
-        /* Construct a callback data. */
-        callback_data_t cd;
-        cd.instance = instance;
-        cd.proc_evaluate = proc_evaluate;
-        cd.proc_stepbound = proc_stepbound;
-        cd.proc_progress = proc_progress;
+        /* Return the new trial value. */
+        t = newt;
+        return 0;
+    }
 
-        /* Evaluate the function value and its gradient. */
-        fx = cd.proc_evaluate(cd.instance, x, g);
+    /**
+     * Line search method for smooth functions.
+     *  This function performs line search to find a point that satisfy 
+     *  both the Armijo condition and the strong Wolfe condition, where
+     *  the trial steps are generated by safeguarded cubic and quadratic
+     *  interpolation. It usually needs fewer trials than bisection when 
+     *  f(x) is C1, but it is not suitable for nonsmooth functions.
+     *
+     *  @see
+     *      Jorge J. More and David J. Thuente. Line search algorithm with
+     *      guaranteed sufficient decrease. ACM Transactions on Mathematical
+     *      Software (TOMS), Vol 20, No 3, pp. 286-307, 1994.
+     */
+    inline int line_search_morethuente(Eigen::VectorXd &x,
+                                       double &f,
+                                       Eigen::VectorXd &g,
+                                       double &stp,
+                                       const Eigen::VectorXd &s,
+                                       const Eigen::VectorXd &xp,
+                                       const Eigen::VectorXd &gp,
+                                       const double stpmin,
+                                       const double stpmax,
+                                       const callback_data_t &cd,
+                                       const lbfgs_parameter_t &param)
+    {
+        int count = 0, uinfo = 0;
+        bool brackt = false, stage1 = true;
+        double dg, stx, fx, dgx, sty, fy, dgy;
+        double fxm, dgxm, fym, dgym, fm, dgm;
+        double finit, ftest1, dginit, dgtest;
+        double width, prev_width, stmin, stmax;
 
-        /* Store the initial value of the cost function. */
-        pf(0) = fx;
+        /* Check the input parameters for errors. */
+        if (!(stp > 0.0))
+        {
+            return LBFGSERR_INVALIDPARAMETERS;
+        }
 
-        /*
-        Compute the direction;
-        we assume the initial hessian matrix H_0 as the identity matrix.
-        */
-        d = -g;
+        /* Compute the initial gradient in the search direction. */
+        dginit = gp.dot(s);
+
+        /* Make sure that s points to a descent direction. */
+        if (0.0 < dginit)
+        {
+            return LBFGSERR_INCREASEGRADIENT;
+        }
+
+        /* Initialize local variables. */
+        finit = f;
+        dgtest = param.f_dec_coeff * dginit;
+        width = stpmax - stpmin;
+        prev_width = 2.0 * width;
 
         /*
-        Make sure that the initial variables are not a stationary point.
+        The variables stx, fx, dgx contain the values of the step,
+        function, and directional derivative at the best step.
+        The variables sty, fy, dgy contain the value of the step,
+        function, and derivative at the other endpoint of
+        the interval of uncertainty.
         */
-        gnorm_inf = g.cwiseAbs().maxCoeff();
-        xnorm_inf = x.cwiseAbs().maxCoeff();
+        stx = sty = 0.0;
+        fx = fy = finit;
+        dgx = dgy = dginit;
 
-        if (gnorm_inf / std::max(1.0, xnorm_inf) < param.g_epsilon)
-        {
-            /* The initial guess is already a stationary point. */
-            ret = LBFGS_CONVERGENCE;
-        }
-        else
+        while (true)
         {
-            /* 
-            Compute the initial step:
+            /*
+            Set the minimum and maximum steps to correspond to the
+            present interval of uncertainty.
             */
-            step = 1.0 / d.norm();
+            if (brackt)
+            {
+                stmin = std::min(stx, sty);
+                stmax = std::max(stx, sty);
+            }
+            else
+            {
+                stmin = stx;
+                stmax = stp + 4.0 * (stp - stx);
+            }
 
-            k = 1;
-            end = 0;
-            bound = 0;
+            /* Clip the step in the range of [stpmin, stpmax]. */
+            stp = std::min(stpmax, std::max(stpmin, stp));
 
-            while (true)
+            /*
+            If an unusual termination is to occur then let
+            stp be the lowest point obtained so far.
+            */
+            if (brackt && ((stp <= stmin || stmax <= stp) ||
+                           param.max_linesearch <= count + 1 || uinfo != 0 ||
+                           stmax - stmin <= param.machine_prec * stmax))
             {
-                /* Store the current position and gradient vectors. */
-                xp = x;
-                gp = g;
+                stp = stx;
+            }
 
-                /* If the step bound can be provied dynamically, then apply it. */
-                step_min = param.min_step;
-                step_max = param.max_step;
-                if (cd.proc_stepbound)
-                {
-                    step_max = cd.proc_stepbound(cd.instance, xp, d);
-                    step_max = step_max < param.max_step ? step_max : param.max_step;
-                    step = step < step_max ? step : 0.5 * step_max;
-                }
+            x = xp + stp * s;
 
-                /* Search for an optimal step. */
-                ls = line_search_lewisoverton(x, fx, g, step, d, xp, gp, step_min, step_max, cd, param);
+            /* Evaluate the function and gradient values. */
+            f = cd.proc_evaluate(cd.instance, x, g);
+            ++count;
 
-                if (ls < 0)
-                {
-                    /* Revert to the previous point. */
-                    x = xp;
+            /* Test for errors. */
+            if (std::isinf(f) || std::isnan(f))
+            {
+                return LBFGSERR_INVALID_FUNCVAL;
+            }
+
+            dg = g.dot(s);
+            ftest1 = finit + stp * dgtest;
+
+            /* Test for errors and convergence. */
+            if (brackt && ((stp <= stmin || stmax <= stp) || uinfo != 0))
+            {
+                /* Rounding errors prevent further progress. */
+                return LBFGSERR_ROUNDINGERROR;
+            }
+            if (stp == stpmax && f <= ftest1 && dg <= dgtest)
+            {
+                /* The step is the maximum value. */
+                return LBFGSERR_MAXIMUMSTEP;
+            }
+            if (stp == stpmin && (ftest1 < f || dgtest <= dg))
+            {
+                /* The step is the minimum value. */
+                return LBFGSERR_MINIMUMSTEP;
+            }
+            if (brackt && (stmax - stmin) <= param.machine_prec * stmax)
+            {
+                /* Relative width of the interval of uncertainty is at most machine_prec. */
+                return LBFGSERR_WIDTHTOOSMALL;
+            }
+            if (param.max_linesearch <= count)
+            {
+                /* Maximum number of iteration. */
+                return LBFGSERR_MAXIMUMLINESEARCH;
+            }
+            if (f <= ftest1 && std::fabs(dg) <= param.s_curv_coeff * (-dginit))
+            {
+                /* The sufficient decrease condition and the strong Wolfe condition hold. */
+                return count;
+            }
+
+            /*
+            In the first stage we seek a step for which the modified
+            function has a nonpositive value and nonnegative derivative.
+            */
+            if (stage1 && f <= ftest1 &&
+                std::min(param.f_dec_coeff, param.s_curv_coeff) * dginit <= dg)
+            {
+                stage1 = false;
+            }
+
+            /*
+            A modified function is used to predict the step only if
+            we have not obtained a step for which the modified
+            function has a nonpositive function value and nonnegative
+            derivative, and if a lower function value has been
+            obtained but the decrease is not sufficient.
+            */
+            if (stage1 && ftest1 < f && f <= fx)
+            {
+                /* Define the modified function and derivative values. */
+                fm = f - stp * dgtest;
+                fxm = fx - stx * dgtest;
+                fym = fy - sty * dgtest;
+                dgm = dg - dgtest;
+                dgxm = dgx - dgtest;
+                dgym = dgy - dgtest;
+
+                /* Update the interval of uncertainty and compute the new step. */
+                uinfo = update_trial_interval(stx, fxm, dgxm, sty, fym, dgym,
+                                              stp, fm, dgm, stmin, stmax, brackt);
+
+                /* Reset the function and gradient values for f. */
+                fx = fxm + stx * dgtest;
+                fy = fym + sty * dgtest;
+                dgx = dgxm + dgtest;
+                dgy = dgym + dgtest;
+            }
+            else
+            {
+                /* Update the interval of uncertainty and compute the new step. */
+                uinfo = update_trial_interval(stx, fx, dgx, sty, fy, dgy,
+                                              stp, f, dg, stmin, stmax, brackt);
+            }
+
+            /*
+            Force a sufficient decrease in the interval of uncertainty.
+            */
+            if (brackt)
+            {
+                if (0.66 * prev_width <= std::fabs(sty - stx))
+                {
+                    stp = stx + 0.5 * (sty - stx);
+                }
+                prev_width = width;
+                width = std::fabs(sty - stx);
+            }
+        }
+    }
+
+    /**
+     * Line search dispatcher according to lbfgs_parameter_t::line_search_type.
+     *  The reference cost fref is only used by the nonmonotone line search.
+     */
+    inline int line_search(Eigen::VectorXd &x,
+                           double &f,
+                           Eigen::VectorXd &g,
+                           double &stp,
+                           const Eigen::VectorXd &s,
+                           const Eigen::VectorXd &xp,
+                           const Eigen::VectorXd &gp,
+                           const double stpmin,
+                           const double stpmax,
+                           const double fref,
+                           const callback_data_t &cd,
+                           const lbfgs_parameter_t &param)
+    {
+        switch (param.line_search_type)
+        {
+        case LBFGS_LINESEARCH_MORETHUENTE:
+            return line_search_morethuente(x, f, g, stp, s, xp, gp, stpmin, stpmax, cd, param);
+
+        case LBFGS_LINESEARCH_ZHANGHAGER:
+            return line_search_zhanghager(x, f, g, stp, s, xp, gp, stpmin, stpmax, fref, cd, param);
+
+        default:
+            return line_search_lewisoverton(x, f, g, stp, s, xp, gp, stpmin, stpmax, cd, param);
+        }
+    }
+
+    /**
+     * Check the parameters shared by all solvers for errors.
+     *
+     *  @param  n           The number of variables.
+     *  @param  param       The parameters for optimization.
+     *  @retval int         Zero if all parameters are valid. A negative integer
+     *                      indicates the error of the first invalid one.
+     */
+    inline int check_parameters(const int n,
+                                const lbfgs_parameter_t &param)
+    {
+        if (n <= 0)
+        {
+            return LBFGSERR_INVALID_N;
+        }
+        if (param.g_epsilon < 0.0)
+        {
+            return LBFGSERR_INVALID_GEPSILON;
+        }
+        if (param.past < 0)
+        {
+            return LBFGSERR_INVALID_TESTPERIOD;
+        }
+        if (param.delta < 0.0)
+        {
+            return LBFGSERR_INVALID_DELTA;
+        }
+        if (param.min_step < 0.0)
+        {
+            return LBFGSERR_INVALID_MINSTEP;
+        }
+        if (param.max_step < param.min_step)
+        {
+            return LBFGSERR_INVALID_MAXSTEP;
+        }
+        if (!(param.f_dec_coeff > 0.0 &&
+              param.f_dec_coeff < 1.0))
+        {
+            return LBFGSERR_INVALID_FDECCOEFF;
+        }
+        if (!(param.s_curv_coeff < 1.0 &&
+              param.s_curv_coeff > param.f_dec_coeff))
+        {
+            return LBFGSERR_INVALID_SCURVCOEFF;
+        }
+        if (!(param.machine_prec > 0.0))
+        {
+            return LBFGSERR_INVALID_MACHINEPREC;
+        }
+        if (param.max_linesearch <= 0)
+        {
+            return LBFGSERR_INVALID_MAXLINESEARCH;
+        }
+        if (param.line_search_type < LBFGS_LINESEARCH_LEWISOVERTON ||
+            param.line_search_type > LBFGS_LINESEARCH_ZHANGHAGER)
+        {
+            return LBFGSERR_INVALID_LINESEARCH;
+        }
+        if (!(param.nonmonotone_decay >= 0.0 &&
+              param.nonmonotone_decay <= 1.0))
+        {
+            return LBFGSERR_INVALID_NONMONOTONEDECAY;
+        }
+
+        return 0;
+    }
+
+    /**
+     * Zero the components of a step vector that leave the box [lower, upper]
+     *  at the variables x immediately.
+     */
+    inline void project_direction(const Eigen::VectorXd &x,
+                                  const Eigen::VectorXd &lower,
+                                  const Eigen::VectorXd &upper,
+                                  Eigen::VectorXd &d)
+    {
+        const int n = x.size();
+        for (int i = 0; i < n; i++)
+        {
+            if ((x(i) <= lower(i) && d(i) < 0.0) ||
+                (x(i) >= upper(i) && d(i) > 0.0))
+            {
+                d(i) = 0.0;
+            }
+        }
+        return;
+    }
+
+    /**
+     * Line search method along the projected path for box constraints.
+     *  This function performs the Lewis-Overton line search on the path
+     *      x(stp) = P(xp + stp * s),
+     *  where P is the projection onto the box [lower, upper]. Both the 
+     *  Armijo condition and the weak Wolfe condition are checked along
+     *  the actual displacement x(stp) - xp instead of stp * s. If all 
+     *  moving variables have hit their bounds, further extrapolation 
+     *  changes nothing, thus the Armijo step is accepted directly.
+     */
+    inline int line_search_projected(Eigen::VectorXd &x,
+                                     double &f,
+                                     Eigen::VectorXd &g,
+                                     double &stp,
+                                     const Eigen::VectorXd &s,
+                                     const Eigen::VectorXd &xp,
+                                     const Eigen::VectorXd &gp,
+                                     const Eigen::VectorXd &lower,
+                                     const Eigen::VectorXd &upper,
+                                     const double stpmin,
+                                     const double stpmax,
+                                     const callback_data_t &cd,
+                                     const lbfgs_parameter_t &param)
+    {
+        int count = 0;
+        bool brackt = false, touched = false, moving;
+        double finit, dginit, dx;
+        double mu = 0.0, nu = stpmax;
+
+        /* Check the input parameters for errors. */
+        if (!(stp > 0.0))
+        {
+            return LBFGSERR_INVALIDPARAMETERS;
+        }
+
+        /* Compute the initial gradient in the search direction. */
+        dginit = gp.dot(s);
+
+        /* Make sure that s points to a descent direction. */
+        if (0.0 < dginit)
+        {
+            return LBFGSERR_INCREASEGRADIENT;
+        }
+
+        /* The initial value of the cost function. */
+        finit = f;
+
+        while (true)
+        {
+            x = (xp + stp * s).cwiseMax(lower).cwiseMin(upper);
+
+            /* Evaluate the function and gradient values. */
+            f = cd.proc_evaluate(cd.instance, x, g);
+            ++count;
+
+            /* Test for errors. */
+            if (std::isinf(f) || std::isnan(f))
+            {
+                return LBFGSERR_INVALID_FUNCVAL;
+            }
+
+            /* The directional derivative along the actual displacement. */
+            dx = gp.dot(x - xp);
+
+            /* Check the Armijo condition. */
+            if (!(dx < 0.0) || f > finit + param.f_dec_coeff * dx)
+            {
+                nu = stp;
+                brackt = true;
+            }
+            else
+            {
+                moving = ((s.array() < 0.0 && x.array() > lower.array()) ||
+                          (s.array() > 0.0 && x.array() < upper.array()))
+                             .any();
+
+                /* Check the weak Wolfe condition. */
+                if (moving && g.dot(x - xp) < param.s_curv_coeff * dx)
+                {
+                    mu = stp;
+                }
+                else
+                {
+                    return count;
+                }
+            }
+            if (param.max_linesearch <= count)
+            {
+                /* Maximum number of iteration. */
+                return LBFGSERR_MAXIMUMLINESEARCH;
+            }
+            if (brackt && (nu - mu) < param.machine_prec * nu)
+            {
+                /* Relative interval width is at least machine_prec. */
+                return LBFGSERR_WIDTHTOOSMALL;
+            }
+
+            if (brackt)
+            {
+                stp = 0.5 * (mu + nu);
+            }
+            else
+            {
+                stp *= 2.0;
+            }
+
+            if (stp < stpmin)
+            {
+                /* The step is the minimum value. */
+                return LBFGSERR_MINIMUMSTEP;
+            }
+            if (stp > stpmax)
+            {
+                if (touched)
+                {
+                    /* The step is the maximum value. */
+                    return LBFGSERR_MAXIMUMSTEP;
+                }
+                else
+                {
+                    /* The maximum value should be tried once. */
+                    touched = true;
+                    stp = stpmax;
+                }
+            }
+        }
+    }
+
+    /**
+     * Check the box constraints of the projected L-BFGS for errors.
+     *  Only the Lewis-Overton line search is available along the projected
+     *  path, since the others need a smooth restriction of f(x) to a ray.
+     *
+     *  @param  n           The number of variables.
+     *  @param  lower       The lower bounds of the variables.
+     *  @param  upper       The upper bounds of the variables.
+     *  @param  param       The parameters for optimization.
+     *  @retval int         Zero if the bounds and the line search are valid.
+     */
+    inline int check_bounds(const int n,
+                            const Eigen::VectorXd &lower,
+                            const Eigen::VectorXd &upper,
+                            const lbfgs_parameter_t &param)
+    {
+        if (lower.size() != n || upper.size() != n ||
+            !(lower.array() <= upper.array()).all())
+        {
+            return LBFGSERR_INVALID_BOUNDS;
+        }
+        if (param.line_search_type != LBFGS_LINESEARCH_LEWISOVERTON)
+        {
+            return LBFGSERR_INVALID_LINESEARCH;
+        }
+
+        return 0;
+    }
+
+    /**
+     * The complete state of a L-BFGS minimization process between iterations.
+     *  Together with the parameters and the callbacks, it determines all
+     *  remaining iterations. It can be serialized to pause a minimization
+     *  and resume it later, maybe in another process.
+     */
+    struct lbfgs_state_t
+    {
+        /** The current values of variables. */
+        Eigen::VectorXd x;
+        /** The current gradient values of variables. */
+        Eigen::VectorXd g;
+        /** The search direction of the next iteration. */
+        Eigen::VectorXd d;
+        /** The cost values of the past iterations for delta-based test. */
+        Eigen::VectorXd pf;
+        /** The limited memories of s, y, and y^t \cdot s. */
+        Eigen::MatrixXd lm_s;
+        Eigen::MatrixXd lm_y;
+        Eigen::VectorXd lm_ys;
+        /** The current value of the cost function. */
+        double fx = 0.0;
+        /** The initial step of the next line search. */
+        double step = 0.0;
+        /** The reference cost and its weight for the nonmonotone line search. */
+        double fref = 0.0;
+        double qref = 0.0;
+        /** The iteration count. */
+        int k = 0;
+        /** The next slot and the number of valid slots in the limited memories. */
+        int end = 0;
+        int bound = 0;
+        /** LBFGS_RUNNING before termination, otherwise the return code. */
+        int status = LBFGSERR_UNKNOWNERROR;
+    };
+
+    /**
+     * Iterator-style L-BFGS solver.
+     *  The solver performs exactly the same iterations as lbfgs_optimize(),
+     *  but one iteration per step() call, so that a long minimization can
+     *  be sliced over time. The state() is exposed after each iteration and
+     *  can be serialized and deserialized, without losing the curvature
+     *  information kept in the limited memories. Callbacks, parameters and
+     *  bounds are NOT part of the state and must be bound again for resuming.
+     *  With box constraints set by bind_bounds(), the iterations are the
+     *  ones of projected_lbfgs_optimize() instead.
+     *
+     *  Usage:
+     *      lbfgs_solver solver;
+     *      solver.bind(proc_evaluate, nullptr, nullptr, nullptr, instance, param);
+     *      int ret = solver.init(x0);      // or solver.deserialize(is)
+     *      while (ret == LBFGS_RUNNING)
+     *      {
+     *          ret = solver.step();
+     *      }
+     */
+    class lbfgs_solver
+    {
+    private:
+        callback_data_t cd;
+        lbfgs_parameter_t param;
+        lbfgs_state_t st;
+
+        Eigen::VectorXd xp;
+        Eigen::VectorXd gp;
+        Eigen::VectorXd my;
+        Eigen::VectorXd lm_alpha;
+
+        /* The box constraints and the mask of free variables if boxed. */
+        bool boxed = false;
+        Eigen::VectorXd lower;
+        Eigen::VectorXd upper;
+        Eigen::VectorXd fm;
+
+        /* The header of serialized states. */
+        enum : unsigned int
+        {
+            STATE_MAGIC = 0x4C424653u,
+            STATE_VERSION = 2u
+        };
+
+        inline int check(const int n) const
+        {
+            if (param.mem_size <= 0)
+            {
+                return LBFGSERR_INVALID_MEMSIZE;
+            }
+            const int ret = check_parameters(n, param);
+            if (ret < 0 || !boxed)
+            {
+                return ret;
+            }
+            return check_bounds(n, lower, upper, param);
+        }
+
+        inline void allocate(const int n)
+        {
+            xp.resize(n);
+            gp.resize(n);
+            my.resize(n);
+            fm.resize(boxed ? n : 0);
+            lm_alpha = Eigen::VectorXd::Zero(param.mem_size);
+            return;
+        }
+
+        /* The infinity norm of the gradient, or of the projected gradient
+           P(x - g(x)) - x if boxed. */
+        inline double gradient_norm_inf() const
+        {
+            if (boxed)
+            {
+                return ((st.x - st.g).cwiseMax(lower).cwiseMin(upper) - st.x).cwiseAbs().maxCoeff();
+            }
+            return st.g.cwiseAbs().maxCoeff();
+        }
+
+        template <typename T>
+        static inline void write(std::ostream &os, const T &v)
+        {
+            os.write(reinterpret_cast<const char *>(&v), sizeof(T));
+            return;
+        }
+
+        template <typename T>
+        static inline bool read(std::istream &is, T &v)
+        {
+            return (bool)is.read(reinterpret_cast<char *>(&v), sizeof(T));
+        }
+
+        template <typename EIGENMAT>
+        static inline void writeMat(std::ostream &os, const EIGENMAT &mat)
+        {
+            os.write(reinterpret_cast<const char *>(mat.data()),
+                     mat.size() * sizeof(double));
+            return;
+        }
+
+        template <typename EIGENMAT>
+        static inline bool readMat(std::istream &is, EIGENMAT &mat)
+        {
+            return (bool)is.read(reinterpret_cast<char *>(mat.data()),
+                                 mat.size() * sizeof(double));
+        }
+
+    public:
+        /**
+         * Bind the callbacks and the parameters.
+         *  See lbfgs_optimize() for details of arguments. It must be called
+         *  before init() or deserialize(), and it removes the bounds.
+         */
+        inline void bind(lbfgs_evaluate_t proc_evaluate,
+                         lbfgs_stepbound_t proc_stepbound,
+                         lbfgs_progress_t proc_progress,
+                         lbfgs_precondition_t proc_precondition,
+                         void *instance,
+                         const lbfgs_parameter_t &parameters)
+        {
+            cd.instance = instance;
+            cd.proc_evaluate = proc_evaluate;
+            cd.proc_stepbound = proc_stepbound;
+            cd.proc_progress = proc_progress;
+            cd.proc_precondition = proc_precondition;
+            param = parameters;
+            boxed = false;
+            return;
+        }
+
+        /**
+         * Bind the box constraints lower <= x <= upper after bind().
+         *  See projected_lbfgs_optimize() for details of arguments.
+         */
+        inline void bind_bounds(const Eigen::VectorXd &lower_bounds,
+                                const Eigen::VectorXd &upper_bounds)
+        {
+            boxed = true;
+            lower = lower_bounds;
+            upper = upper_bounds;
+            return;
+        }
+
+        /**
+         * Start a new minimization from the initial guess x0.
+         *
+         *  @param  x0          The initial guess of decision variables.
+         *  @retval int         LBFGS_RUNNING if iterations are needed, otherwise
+         *                      the final status code as in lbfgs_optimize().
+         */
+        inline int init(const Eigen::VectorXd &x0)
+        {
+            const int n = x0.size();
+            const int m = param.mem_size;
+
+            /* Check the input parameters for errors. */
+            st.status = check(n);
+            if (st.status < 0)
+            {
+                return st.status;
+            }
+
+            /* Prepare intermediate variables. */
+            allocate(n);
+            st.x = x0;
+            if (boxed)
+            {
+                /* Make the initial guess feasible. */
+                st.x = st.x.cwiseMax(lower).cwiseMin(upper);
+            }
+            st.g.resize(n);
+            st.d.resize(n);
+            st.pf.resize(std::max(1, param.past));
+
+            /* Initialize the limited memory. */
+            st.lm_s = Eigen::MatrixXd::Zero(n, m);
+            st.lm_y = Eigen::MatrixXd::Zero(n, m);
+            st.lm_ys = Eigen::VectorXd::Zero(m);
+
+            /* Evaluate the function value and its gradient. */
+            st.fx = cd.proc_evaluate(cd.instance, st.x, st.g);
+
+            /* Store the initial value of the cost function. */
+            st.pf(0) = st.fx;
+            st.fref = st.fx;
+            st.qref = 1.0;
+            st.k = 1;
+            st.end = 0;
+            st.bound = 0;
+
+            /*
+            Compute the direction;
+            we assume the initial hessian matrix H_0 as the identity matrix,
+            or as the preconditioner M if it is provided, on free variables.
+            */
+            st.d = -st.g;
+            if (boxed)
+            {
+                project_direction(st.x, lower, upper, st.d);
+            }
+            if (cd.proc_precondition)
+            {
+                cd.proc_precondition(cd.instance, st.d);
+            }
+
+            /*
+            Make sure that the initial variables are not a stationary point.
+            */
+            const double gnorm_inf = gradient_norm_inf();
+            const double xnorm_inf = st.x.cwiseAbs().maxCoeff();
+
+            if (gnorm_inf / std::max(1.0, xnorm_inf) < param.g_epsilon ||
+                !(st.d.squaredNorm() > 0.0))
+            {
+                /* The initial guess is already a stationary point. */
+                st.status = LBFGS_CONVERGENCE;
+            }
+            else
+            {
+                /* 
+                Compute the initial step:
+                */
+                st.step = 1.0 / st.d.norm();
+
+                st.status = LBFGS_RUNNING;
+            }
+
+            return st.status;
+        }
+
+        /**
+         * Perform one iteration, i.e., a line search and a memory update.
+         *
+         *  @retval int         LBFGS_RUNNING if more iterations are needed,
+         *                      otherwise the final status code as in
+         *                      lbfgs_optimize(). A terminated solver keeps
+         *                      returning its final status code.
+         */
+        inline int step()
+        {
+            int i, j, ls;
+            double step_min, step_max, ys, yy;
+            double gnorm_inf, xnorm_inf, beta, rate, cau;
+
+            if (st.status != LBFGS_RUNNING)
+            {
+                return st.status;
+            }
+
+            const int m = param.mem_size;
+            Eigen::VectorXd &x = st.x;
+            Eigen::VectorXd &g = st.g;
+            Eigen::VectorXd &d = st.d;
+            double &fx = st.fx;
+            double &step = st.step;
+            int &k = st.k;
+            int &end = st.end;
+            int &bound = st.bound;
+
+            /* Store the current position and gradient vectors. */
+            xp = x;
+            gp = g;
+            const double fp = fx;
+
+            /* If the step bound can be provied dynamically, then apply it. */
+            step_min = param.min_step;
+            step_max = param.max_step;
+            if (cd.proc_stepbound)
+            {
+                step_max = cd.proc_stepbound(cd.instance, xp, d);
+                step_max = step_max < param.max_step ? step_max : param.max_step;
+                step = step < step_max ? step : 0.5 * step_max;
+            }
+
+            /* Search for an optimal step. */
+            if (boxed)
+            {
+                ls = line_search_projected(x, fx, g, step, d, xp, gp, lower, upper,
+                                           step_min, step_max, cd, param);
+            }
+            else
+            {
+                ls = line_search(x, fx, g, step, d, xp, gp, step_min, step_max, st.fref, cd, param);
+            }
+
+            if (ls < 0)
+            {
+                /* Revert to the previous point. */
+                x = xp;
+                g = gp;
+                fx = fp;
+                st.status = ls;
+                return st.status;
+            }
+
+            /*
+            Update the reference cost for the nonmonotone line search:
+            q_{k+1} = \eta * q_{k} + 1,
+            c_{k+1} = (\eta * q_{k} * c_{k} + f_{k+1}) / q_{k+1}.
+            */
+            st.fref = param.nonmonotone_decay * st.qref * st.fref + fx;
+            st.qref = param.nonmonotone_decay * st.qref + 1.0;
+            st.fref /= st.qref;
+
+            /* Report the progress. */
+            if (cd.proc_progress)
+            {
+                if (cd.proc_progress(cd.instance, x, g, fx, step, k, ls))
+                {
+                    st.status = LBFGS_CANCELED;
+                    return st.status;
+                }
+            }
+
+            /*
+            Convergence test.
+            The criterion is given by the following formula:
+            ||g(x)||_inf / max(1, ||x||_inf) < g_epsilon,
+            where g(x) is replaced by P(x - g(x)) - x if boxed.
+            */
+            gnorm_inf = gradient_norm_inf();
+            xnorm_inf = x.cwiseAbs().maxCoeff();
+            if (gnorm_inf / std::max(1.0, xnorm_inf) < param.g_epsilon)
+            {
+                /* Convergence. */
+                st.status = LBFGS_CONVERGENCE;
+                return st.status;
+            }
+
+            /*
+            Test for stopping criterion.
+            The criterion is given by the following formula:
+            |f(past_x) - f(x)| / max(1, |f(x)|) < \delta.
+            */
+            if (0 < param.past)
+            {
+                /* We don't test the stopping criterion while k < past. */
+                if (param.past <= k)
+                {
+                    /* The stopping criterion. */
+                    rate = std::fabs(st.pf(k % param.past) - fx) / std::max(1.0, std::fabs(fx));
+
+                    if (rate < param.delta)
+                    {
+                        st.status = LBFGS_STOP;
+                        return st.status;
+                    }
+                }
+
+                /* Store the current value of the cost function. */
+                st.pf(k % param.past) = fx;
+            }
+
+            if (param.max_iterations != 0 && param.max_iterations <= k)
+            {
+                /* Maximum number of iterations. */
+                st.status = LBFGSERR_MAXIMUMITERATION;
+                return st.status;
+            }
+
+            /* Count the iteration number. */
+            ++k;
+
+            /*
+            Update vectors s and y:
+            s_{k+1} = x_{k+1} - x_{k} = \step * d_{k}.
+            y_{k+1} = g_{k+1} - g_{k}.
+            */
+            st.lm_s.col(end) = x - xp;
+            st.lm_y.col(end) = g - gp;
+
+            /*
+            Compute scalars ys and yy:
+            ys = y^t \cdot s = 1 / \rho.
+            yy = y^t \cdot y.
+            Notice that yy is used for scaling the hessian matrix H_0 (Cholesky factor).
+            */
+            ys = st.lm_y.col(end).dot(st.lm_s.col(end));
+            if (cd.proc_precondition)
+            {
+                /* yy = y^t \cdot M \cdot y when the preconditioner M is used. */
+                my = st.lm_y.col(end);
+                cd.proc_precondition(cd.instance, my);
+                yy = st.lm_y.col(end).dot(my);
+            }
+            else
+            {
+                yy = st.lm_y.col(end).squaredNorm();
+            }
+            st.lm_ys(end) = ys;
+
+            /* Compute the negative of gradients. */
+            d = -g;
+            if (boxed)
+            {
+                /*
+                Fix the variables at their bounds with the gradient pointing
+                outwards, and keep the negative of gradients on free ones.
+                */
+                project_direction(x, lower, upper, d);
+                fm = (d.array() != 0.0 || g.array() == 0.0).cast<double>();
+                d = -g.cwiseProduct(fm);
+            }
+
+            /* 
+            Only cautious update is performed here as long as 
+            (y^t \cdot s) / ||s_{k+1}||^2 > \epsilon * ||g_{k}||^\alpha,
+            where \epsilon is the cautious factor and a proposed value 
+            for \alpha is 1.
+            This is not for enforcing the PD of the approxomated Hessian 
+            since ys > 0 is already ensured by the weak Wolfe condition. 
+            This is to ensure the global convergence as described in:
+            Dong-Hui Li and Masao Fukushima. On the global convergence of 
+            the BFGS method for nonconvex unconstrained optimization problems. 
+            SIAM Journal on Optimization, Vol 11, No 4, pp. 1054-1064, 2011.
+            */
+            cau = st.lm_s.col(end).squaredNorm() * gp.norm() * param.cautious_factor;
+
+            if (ys > cau)
+            {
+                /*
+                Recursive formula to compute dir = -(H \cdot g).
+                This is described in page 779 of:
+                Jorge Nocedal.
+                Updating Quasi-Newton Matrices with Limited Storage.
+                Mathematics of Computation, Vol. 35, No. 151,
+                pp. 773--782, 1980.
+                */
+                ++bound;
+                bound = m < bound ? m : bound;
+                end = (end + 1) % m;
+
+                j = end;
+                for (i = 0; i < bound; ++i)
+                {
+                    j = (j + m - 1) % m; /* if (--j == -1) j = m-1; */
+                    /* \alpha_{j} = \rho_{j} s^{t}_{j} \cdot q_{k+1}. */
+                    lm_alpha(j) = st.lm_s.col(j).dot(d) / st.lm_ys(j);
+                    /* q_{i} = q_{i+1} - \alpha_{i} y_{i}. */
+                    d += (-lm_alpha(j)) * st.lm_y.col(j);
+                }
+
+                if (cd.proc_precondition)
+                {
+                    cd.proc_precondition(cd.instance, d);
+                }
+                d *= ys / yy;
+
+                for (i = 0; i < bound; ++i)
+                {
+                    /* \beta_{j} = \rho_{j} y^t_{j} \cdot \gamm_{i}. */
+                    beta = st.lm_y.col(j).dot(d) / st.lm_ys(j);
+                    /* \gamm_{i+1} = \gamm_{i} + (\alpha_{j} - \beta_{j}) s_{j}. */
+                    d += (lm_alpha(j) - beta) * st.lm_s.col(j);
+                    j = (j + 1) % m; /* if (++j == m) j = 0; */
+                }
+            }
+            else if (cd.proc_precondition)
+            {
+                cd.proc_precondition(cd.instance, d);
+            }
+
+            if (boxed)
+            {
+                /* Restrict the direction to free variables inside the box. */
+                d = d.cwiseProduct(fm);
+                project_direction(x, lower, upper, d);
+
+                /*
+                The reduced quasi-Newton direction may not be a descent one
+                after the restriction, then the (preconditioned) projected
+                steepest descent is used instead.
+                */
+                if (!(g.dot(d) < 0.0))
+                {
+                    d = -g.cwiseProduct(fm);
+                    if (cd.proc_precondition)
+                    {
+                        cd.proc_precondition(cd.instance, d);
+                    }
+                    project_direction(x, lower, upper, d);
+                    if (!(g.dot(d) < 0.0))
+                    {
+                        /* No feasible descent direction exists. */
+                        st.status = LBFGS_CONVERGENCE;
+                        return st.status;
+                    }
+                }
+            }
+
+            /* The search direction d is ready. We try step = 1 first. */
+            step = 1.0;
+
+            return st.status;
+        }
+
+        /**
+         * Get the state after the last iteration.
+         */
+        inline const lbfgs_state_t &state() const
+        {
+            return st;
+        }
+
+        /**
+         * Write the state in a compact binary layout, i.e., a header of
+         *  [magic, version, n, mem_size, past] followed by the scalars
+         *  and the raw column-major data of all vectors and matrices.
+         *  The byte order and the floating-point format of the platform
+         *  are used, which are shared by processes on the same machine.
+         *
+         *  @param  os          The binary output stream.
+         *  @retval bool        True if the state is written successfully.
+         */
+        inline bool serialize(std::ostream &os) const
+        {
+            write(os, (unsigned int)STATE_MAGIC);
+            write(os, (unsigned int)STATE_VERSION);
+            write(os, (int)st.x.size());
+            write(os, (int)st.lm_ys.size());
+            write(os, (int)st.pf.size());
+            write(os, st.fx);
+            write(os, st.step);
+            write(os, st.fref);
+            write(os, st.qref);
+            write(os, st.k);
+            write(os, st.end);
+            write(os, st.bound);
+            write(os, st.status);
+            writeMat(os, st.x);
+            writeMat(os, st.g);
+            writeMat(os, st.d);
+            writeMat(os, st.pf);
+            writeMat(os, st.lm_s);
+            writeMat(os, st.lm_y);
+            writeMat(os, st.lm_ys);
+            return (bool)os;
+        }
+
+        /**
+         * Read a state written by serialize() to resume the minimization.
+         *  The callbacks and the parameters must be bound before, where
+         *  mem_size and past must equal the ones used for the state.
+         *
+         *  @param  is          The binary input stream.
+         *  @retval int         LBFGS_RUNNING if more iterations are needed,
+         *                      otherwise the status code in the state.
+         *                      LBFGSERR_UNKNOWNERROR indicates a corrupted
+         *                      or mismatched stream.
+         */
+        inline int deserialize(std::istream &is)
+        {
+            unsigned int mg, ver;
+            int n, m, past;
+            if (!read(is, mg) || !read(is, ver) || mg != STATE_MAGIC || ver != STATE_VERSION ||
+                !read(is, n) || !read(is, m) || !read(is, past) ||
+                m != param.mem_size || past != std::max(1, param.past))
+            {
+                st.status = LBFGSERR_UNKNOWNERROR;
+                return st.status;
+            }
+
+            st.status = check(n);
+            if (st.status < 0)
+            {
+                return st.status;
+            }
+
+            allocate(n);
+            st.x.resize(n);
+            st.g.resize(n);
+            st.d.resize(n);
+            st.pf.resize(past);
+            st.lm_s.resize(n, m);
+            st.lm_y.resize(n, m);
+            st.lm_ys.resize(m);
+
+            if (!read(is, st.fx) || !read(is, st.step) ||
+                !read(is, st.fref) || !read(is, st.qref) ||
+                !read(is, st.k) || !read(is, st.end) ||
+                !read(is, st.bound) || !read(is, st.status) ||
+                !readMat(is, st.x) || !readMat(is, st.g) ||
+                !readMat(is, st.d) || !readMat(is, st.pf) ||
+                !readMat(is, st.lm_s) || !readMat(is, st.lm_y) ||
+                !readMat(is, st.lm_ys))
+            {
+                st.status = LBFGSERR_UNKNOWNERROR;
+                return st.status;
+            }
+
+            /* The counters index the limited memories and must be in range. */
+            if (st.k < 1 || st.end < 0 || st.end >= m ||
+                st.bound < 0 || st.bound > m)
+            {
+                st.status = LBFGSERR_UNKNOWNERROR;
+            }
+
+            return st.status;
+        }
+    };
+
+    /**
+     * Start a L-BFGS optimization.
+     * Assumptions: 1. f(x) is either C2 or C0 but piecewise C2;
+     *              2. f(x) is lower bounded;
+     *              3. f(x) has bounded level sets;
+     *              4. g(x) is either the gradient or subgradient;
+     *              5. The gradient exists at the initial guess x0.
+     * A user must implement a function compatible with ::lbfgs_evaluate_t (evaluation
+     * callback) and pass the pointer to the callback function to lbfgs_optimize() 
+     * arguments. Similarly, a user can implement a function compatible with 
+     * ::lbfgs_stepbound_t to provide an external upper bound for stepsize, and 
+     * ::lbfgs_progress_t (progress callback) to obtain the current progress 
+     * (e.g., variables, function, and gradient, etc) and to cancel the iteration 
+     * process if necessary. Implementation of the stepbound and the progress callback 
+     * is optional: a user can pass nullptr if progress notification is not necessary.
+     * A user can also implement ::lbfgs_precondition_t to provide a fixed diagonal
+     * or block-diagonal preconditioner for badly scaled variables.
+     * 
+     *
+     *  @param  x               The vector of decision variables.
+     *                          THE INITIAL GUESS x0 SHOULD BE SET BEFORE THE CALL!
+     *                          A client program can receive decision variables 
+     *                          through this vector, at which the cost and its 
+     *                          gradient are queried during minimization.
+     *  @param  f               The ref to the variable that receives the final
+     *                          value of the cost function for the variables.
+     *  @param  proc_evaluate   The callback function to provide function f(x) and
+     *                          gradient g(x) evaluations given a current values of
+     *                          variables x. A client program must implement a
+     *                          callback function compatible with lbfgs_evaluate_t 
+     *                          and pass the pointer to the callback function.
+     *  @param  proc_stepbound  The callback function to provide values of the
+     *                          upperbound of the stepsize to search in, provided
+     *                          with the beginning values of variables before the 
+     *                          line search, and the current step vector (can be 
+     *                          negative gradient). A client program can implement
+     *                          this function for more efficient linesearch. If it is
+     *                          not used, just set it nullptr.
+     *  @param  proc_progress   The callback function to receive the progress
+     *                          (the number of iterations, the current value of
+     *                          the cost function) of the minimization
+     *                          process. This argument can be set to nullptr if
+     *                          a progress report is unnecessary.
+     *  @param  proc_precondition The callback function to apply a fixed preconditioner
+     *                          M, which approximates the inverse hessian matrix up
+     *                          to a scalar, to a vector. A client program can
+     *                          implement this function when variables are badly
+     *                          scaled. If it is not used, just set it nullptr.
+     *  @param  instance        A user data pointer for client programs. The callback
+     *                          functions will receive the value of this argument.
+     *  @param  param           The parameters for L-BFGS optimization.
+     *  @retval int             The status code. This function returns a nonnegative 
+     *                          integer if the minimization process terminates without 
+     *                          an error. A negative integer indicates an error.
+     */
+    inline int lbfgs_optimize(Eigen::VectorXd &x,
+                              double &f,
+                              lbfgs_evaluate_t proc_evaluate,
+                              lbfgs_stepbound_t proc_stepbound,
+                              lbfgs_progress_t proc_progress,
+                              lbfgs_precondition_t proc_precondition,
+                              void *instance,
+                              const lbfgs_parameter_t &param)
+    {
+        /* Check the input parameters for errors. */
+        if (param.mem_size <= 0)
+        {
+            return LBFGSERR_INVALID_MEMSIZE;
+        }
+        int ret = check_parameters(x.size(), param);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        lbfgs_solver solver;
+        solver.bind(proc_evaluate, proc_stepbound, proc_progress,
+                    proc_precondition, instance, param);
+
+        ret = solver.init(x);
+
+        while (ret == LBFGS_RUNNING)
+        {
+            ret = solver.step();
+        }
+
+        /* Return the final variables and value of the cost function. */
+        x = solver.state().x;
+        f = solver.state().fx;
+
+        return ret;
+    }
+
+    /**
+     * Start a L-BFGS optimization without preconditioning.
+     *  See the above lbfgs_optimize() for details of arguments.
+     */
+    inline int lbfgs_optimize(Eigen::VectorXd &x,
+                              double &f,
+                              lbfgs_evaluate_t proc_evaluate,
+                              lbfgs_stepbound_t proc_stepbound,
+                              lbfgs_progress_t proc_progress,
+                              void *instance,
+                              const lbfgs_parameter_t &param)
+    {
+        return lbfgs_optimize(x, f, proc_evaluate, proc_stepbound,
+                              proc_progress, nullptr, instance, param);
+    }
+
+    // ----------------------- Newton-CG Part -----------------------
+
+    /**
+     * Start a truncated Newton (Newton-CG) optimization.
+     *  This routine shares the callbacks, the parameters, and the return codes
+     *  with lbfgs_optimize(), and is meant for high-accuracy minimization of
+     *  C2 functions where L-BFGS needs too many iterations. Each search
+     *  direction approximately solves the Newton system H(x) \cdot d = -g(x)
+     *  by (preconditioned) conjugate gradient iterations, which are truncated
+     *  once the residual is reduced by min(0.5, sqrt(||g||)) or once negative
+     *  curvature is met. Hessian-vector products are approximated by forward
+     *  differences of the analytic gradient:
+     *      H(x) \cdot v ~= (g(x + h * v) - g(x)) / h,
+     *  thus only ::lbfgs_evaluate_t is needed as in L-BFGS. The line search
+     *  always tries the Newton step first. The parameter mem_size is unused,
+     *  while max_cg_iterations limits the conjugate gradient iterations.
+     *  The progress callback reports the number of all evaluations of each
+     *  iteration, including the ones for hessian-vector products.
+     *
+     *  @see
+     *      Stephen G. Nash. A survey of truncated-Newton methods. Journal of
+     *      Computational and Applied Mathematics, Vol 124, No 1-2, pp. 45-59, 2000.
+     */
+    inline int newton_cg_optimize(Eigen::VectorXd &x,
+                                  double &f,
+                                  lbfgs_evaluate_t proc_evaluate,
+                                  lbfgs_stepbound_t proc_stepbound,
+                                  lbfgs_progress_t proc_progress,
+                                  lbfgs_precondition_t proc_precondition,
+                                  void *instance,
+                                  const lbfgs_parameter_t &param)
+    {
+        int ret, k, ls, cg, maxcg;
+        double step, step_min, step_max, fx, fp, rate, fref, qref;
+        double gnorm_inf, xnorm_inf, forcing, ry, ry_next, pHp, pnorm, fdstep;
+
+        const int n = x.size();
+
+        /* Check the input parameters for errors. */
+        ret = check_parameters(n, param);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        maxcg = param.max_cg_iterations > 0 ? std::min(param.max_cg_iterations, n) : n;
+
+        /* Prepare intermediate variables. */
+        Eigen::VectorXd xp(n);
+        Eigen::VectorXd g(n);
+        Eigen::VectorXd gp(n);
+        Eigen::VectorXd d(n);
+        Eigen::VectorXd pf(std::max(1, param.past));
+
+        /* Variables for conjugate gradient iterations. */
+        Eigen::VectorXd r(n);
+        Eigen::VectorXd z(n);
+        Eigen::VectorXd p(n);
+        Eigen::VectorXd hp(n);
+        Eigen::VectorXd xt(n);
+        Eigen::VectorXd gt(n);
+
+        /* Construct a callback data. */
+        callback_data_t cd;
+        cd.instance = instance;
+        cd.proc_evaluate = proc_evaluate;
+        cd.proc_stepbound = proc_stepbound;
+        cd.proc_progress = proc_progress;
+        cd.proc_precondition = proc_precondition;
+
+        /* Evaluate the function value and its gradient. */
+        fx = cd.proc_evaluate(cd.instance, x, g);
+
+        /* Store the initial value of the cost function. */
+        pf(0) = fx;
+        fref = fx;
+        qref = 1.0;
+
+        gnorm_inf = g.cwiseAbs().maxCoeff();
+        xnorm_inf = x.cwiseAbs().maxCoeff();
+
+        if (gnorm_inf / std::max(1.0, xnorm_inf) < param.g_epsilon)
+        {
+            /* The initial guess is already a stationary point. */
+            ret = LBFGS_CONVERGENCE;
+        }
+        else
+        {
+            k = 1;
+
+            while (true)
+            {
+                /*
+                Compute the search direction by conjugate gradient iterations
+                on H \cdot d = -g, where the residual r = -g - H \cdot d.
+                */
+                d.setZero();
+                r = -g;
+                z = r;
+                if (cd.proc_precondition)
+                {
+                    cd.proc_precondition(cd.instance, z);
+                }
+                p = z;
+                ry = r.dot(z);
+                forcing = std::min(0.5, std::sqrt(g.norm())) * g.norm();
+                fdstep = std::sqrt(param.machine_prec) * std::max(1.0, x.norm());
+
+                for (cg = 0; cg < maxcg;)
+                {
+                    /* A vanishing direction admits no difference quotient. */
+                    pnorm = p.norm();
+                    if (!(pnorm > 0.0))
+                    {
+                        if (cg == 0)
+                        {
+                            /* Fall back to the steepest descent. */
+                            d = r;
+                        }
+                        break;
+                    }
+
+                    /* Forward difference for the hessian-vector product. */
+                    xt = x + (fdstep / pnorm) * p;
+                    cd.proc_evaluate(cd.instance, xt, gt);
+                    hp = (gt - g) * (pnorm / fdstep);
+                    ++cg;
+
+                    /* Negative curvature or invalid values terminate iterations. */
+                    pHp = p.dot(hp);
+                    if (!(pHp > param.machine_prec * p.squaredNorm()))
+                    {
+                        if (cg == 1)
+                        {
+                            /* Fall back to the preconditioned steepest descent. */
+                            d = p;
+                        }
+                        break;
+                    }
+
+                    d += (ry / pHp) * p;
+                    r -= (ry / pHp) * hp;
+                    if (r.norm() <= forcing)
+                    {
+                        break;
+                    }
+
+                    z = r;
+                    if (cd.proc_precondition)
+                    {
+                        cd.proc_precondition(cd.instance, z);
+                    }
+                    ry_next = r.dot(z);
+                    p = z + (ry_next / ry) * p;
+                    ry = ry_next;
+                }
+
+                /* Store the current position, gradient vectors and cost. */
+                xp = x;
+                gp = g;
+                fp = fx;
+
+                /*
+                The Newton step is always tried first, unless it is too long
+                to be trusted, i.e., ||d|| > max(1, ||x||).
+                */
+                step = std::min(1.0, std::max(1.0, x.norm()) / d.norm());
+
+                /* If the step bound can be provied dynamically, then apply it. */
+                step_min = param.min_step;
+                step_max = param.max_step;
+                if (cd.proc_stepbound)
+                {
+                    step_max = cd.proc_stepbound(cd.instance, xp, d);
+                    step_max = step_max < param.max_step ? step_max : param.max_step;
+                    step = step < step_max ? step : 0.5 * step_max;
+                }
+
+                /* Search for an optimal step. */
+                ls = line_search(x, fx, g, step, d, xp, gp, step_min, step_max, fref, cd, param);
+
+                if (ls < 0)
+                {
+                    /* Revert to the previous point. */
+                    x = xp;
                     g = gp;
+                    fx = fp;
                     ret = ls;
                     break;
                 }
 
+                /* Update the reference cost for the nonmonotone line search. */
+                fref = param.nonmonotone_decay * qref * fref + fx;
+                qref = param.nonmonotone_decay * qref + 1.0;
+                fref /= qref;
+
                 /* Report the progress. */
                 if (cd.proc_progress)
                 {
-                    if (cd.proc_progress(cd.instance, x, g, fx, step, k, ls))
+                    if (cd.proc_progress(cd.instance, x, g, fx, step, k, ls + cg))
                     {
                         ret = LBFGS_CANCELED;
                         break;
@@ -634,85 +2242,92 @@ namespace lbfgs
 
                 /* Count the iteration number. */
                 ++k;
+            }
+        }
 
-                /*
-                Update vectors s and y:
-                s_{k+1} = x_{k+1} - x_{k} = \step * d_{k}.
-                y_{k+1} = g_{k+1} - g_{k}.
-                */
-                lm_s.col(end) = x - xp;
-                lm_y.col(end) = g - gp;
-
-                /*
-                Compute scalars ys and yy:
-                ys = y^t \cdot s = 1 / \rho.
-                yy = y^t \cdot y.
-                Notice that yy is used for scaling the hessian matrix H_0 (Cholesky factor).
-                */
-                ys = lm_y.col(end).dot(lm_s.col(end));
-                yy = lm_y.col(end).squaredNorm();
-                lm_ys(end) = ys;
+        /* Return the final value of the cost function. */
+        f = fx;
 
-                /* Compute the negative of gradients. */
-                d = -g;
+        return ret;
+    }
 
-                /* 
-                Only cautious update is performed here as long as 
-                (y^t \cdot s) / ||s_{k+1}||^2 > \epsilon * ||g_{k}||^\alpha,
-                where \epsilon is the cautious factor and a proposed value 
-                for \alpha is 1.
-                This is not for enforcing the PD of the approxomated Hessian 
-                since ys > 0 is already ensured by the weak Wolfe condition. 
-                This is to ensure the global convergence as described in:
-                Dong-Hui Li and Masao Fukushima. On the global convergence of 
-                the BFGS method for nonconvex unconstrained optimization problems. 
-                SIAM Journal on Optimization, Vol 11, No 4, pp. 1054-1064, 2011.
-                */
-                cau = lm_s.col(end).squaredNorm() * gp.norm() * param.cautious_factor;
+    // ----------------------- Projected L-BFGS Part -----------------------
 
-                if (ys > cau)
-                {
-                    /*
-                    Recursive formula to compute dir = -(H \cdot g).
-                    This is described in page 779 of:
-                    Jorge Nocedal.
-                    Updating Quasi-Newton Matrices with Limited Storage.
-                    Mathematics of Computation, Vol. 35, No. 151,
-                    pp. 773--782, 1980.
-                    */
-                    ++bound;
-                    bound = m < bound ? m : bound;
-                    end = (end + 1) % m;
-
-                    j = end;
-                    for (i = 0; i < bound; ++i)
-                    {
-                        j = (j + m - 1) % m; /* if (--j == -1) j = m-1; */
-                        /* \alpha_{j} = \rho_{j} s^{t}_{j} \cdot q_{k+1}. */
-                        lm_alpha(j) = lm_s.col(j).dot(d) / lm_ys(j);
-                        /* q_{i} = q_{i+1} - \alpha_{i} y_{i}. */
-                        d += (-lm_alpha(j)) * lm_y.col(j);
-                    }
+    /**
+     * Start a projected L-BFGS optimization with box constraints.
+     *  This routine minimizes f(x) subject to lower <= x <= upper, and shares 
+     *  the callbacks, the parameters, and the return codes with lbfgs_optimize().
+     *  Infinite bounds are allowed for unbounded variables. In each iteration,
+     *  the variables at their bounds with the gradient pointing outwards are 
+     *  fixed, the two-loop recursion is applied on the remaining ones, and 
+     *  the line search runs along the projected path. It is a lightweight 
+     *  alternative to L-BFGS-B without the generalized Cauchy point and the 
+     *  subspace minimization, which is sufficient when only a few bounds are 
+     *  active at the minimum. The preconditioner, if provided, must be 
+     *  diagonal so that it keeps the fixed variables unchanged. The gradient 
+     *  convergence test uses the projected gradient P(x - g(x)) - x. The
+     *  iterations are performed by lbfgs_solver with bind_bounds(), where
+     *  line_search_projected() replaces the line search dispatcher. Thus only
+     *  LBFGS_LINESEARCH_LEWISOVERTON is supported as line_search_type, and
+     *  LBFGSERR_INVALID_LINESEARCH is returned for the others.
+     *
+     *  @param  x               The vector of decision variables, projected onto
+     *                          the box before the minimization.
+     *  @param  f               The ref to the variable that receives the final
+     *                          value of the cost function for the variables.
+     *  @param  lower           The lower bounds of the variables, can be -inf.
+     *  @param  upper           The upper bounds of the variables, can be inf.
+     *  @retval int             The status code as in lbfgs_optimize().
+     *
+     *  See lbfgs_optimize() for the other arguments.
+     *
+     *  @see
+     *      Dongmin Kim, Suvrit Sra, and Inderjit S. Dhillon. Tackling box-constrained 
+     *      optimization via a new projected quasi-Newton approach. SIAM Journal on 
+     *      Scientific Computing, Vol 32, No 6, pp. 3548-3563, 2010.
+     */
+    inline int projected_lbfgs_optimize(Eigen::VectorXd &x,
+                                        double &f,
+                                        const Eigen::VectorXd &lower,
+                                        const Eigen::VectorXd &upper,
+                                        lbfgs_evaluate_t proc_evaluate,
+                                        lbfgs_stepbound_t proc_stepbound,
+                                        lbfgs_progress_t proc_progress,
+                                        lbfgs_precondition_t proc_precondition,
+                                        void *instance,
+                                        const lbfgs_parameter_t &param)
+    {
+        /* Check the input parameters for errors. */
+        if (param.mem_size <= 0)
+        {
+            return LBFGSERR_INVALID_MEMSIZE;
+        }
+        int ret = check_parameters(x.size(), param);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        ret = check_bounds(x.size(), lower, upper, param);
+        if (ret < 0)
+        {
+            return ret;
+        }
 
-                    d *= ys / yy;
+        lbfgs_solver solver;
+        solver.bind(proc_evaluate, proc_stepbound, proc_progress,
+                    proc_precondition, instance, param);
+        solver.bind_bounds(lower, upper);
 
-                    for (i = 0; i < bound; ++i)
-                    {
-                        /* \beta_{j} = \rho_{j} y^t_{j} \cdot \gamm_{i}. */
-                        beta = lm_y.col(j).dot(d) / lm_ys(j);
-                        /* \gamm_{i+1} = \gamm_{i} + (\alpha_{j} - \beta_{j}) s_{j}. */
-                        d += (lm_alpha(j) - beta) * lm_s.col(j);
-                        j = (j + 1) % m; /* if (++j == m) j = 0; */
-                    }
-                }
+        ret = solver.init(x);
 
-                /* The search direction d is ready. We try step = 1 first. */
-                step = 1.0;
-            }
+        while (ret == LBFGS_RUNNING)
+        {
+            ret = solver.step();
         }
 
-        /* Return the final value of the cost function. */
-        f = fx;
+        /* Return the final variables and value of the cost function. */
+        x = solver.state().x;
+        f = solver.state().fx;
 
         return ret;
     }
@@ -735,6 +2350,9 @@ namespace lbfgs
         case LBFGS_CANCELED:
             return "The iteration has been canceled by the monitor callback.";
 
+        case LBFGS_RUNNING:
+            return "The minimization is unfinished.";
+
         case LBFGSERR_UNKNOWNERROR:
             return "Unknown error.";
 
@@ -795,6 +2413,18 @@ namespace lbfgs
         case LBFGSERR_INCREASEGRADIENT:
             return "The current search direction increases the cost function value.";
 
+        case LBFGSERR_INVALID_LINESEARCH:
+            return "Invalid parameter lbfgs_parameter_t::line_search_type specified.";
+
+        case LBFGSERR_INVALID_NONMONOTONEDECAY:
+            return "Invalid parameter lbfgs_parameter_t::nonmonotone_decay specified.";
+
+        case LBFGSERR_ROUNDINGERROR:
+            return "Rounding errors prevent further progress of the line search.";
+
+        case LBFGSERR_INVALID_BOUNDS:
+            return "Invalid lower or upper bounds of variables specified.";
+
         default:
             return "(unknown)";
         }
@@ -512,6 +512,27 @@ namespace minco
             return;
         }
 
+        // Re-solve for new durations ts with the junction positions as well as
+        // the head and tail states of traj fixed, which only takes one banded
+        // LU solve in O(N), e.g., to slow traj down without optimization.
+        // Nothing is changed and false is returned unless traj is nonempty and
+        // ts gives a positive duration for each of its pieces
+        inline bool setParameters(const Trajectory<5> &traj,
+                                  const Eigen::VectorXd &ts)
+        {
+            const int pieceNum = traj.getPieceNum();
+            if (pieceNum < 1 || ts.size() != pieceNum || !(ts.array() > 0.0).all())
+            {
+                return false;
+            }
+            Eigen::Matrix3d headState, tailState;
+            headState << traj.getJuncPos(0), traj.getJuncVel(0), traj.getJuncAcc(0);
+            tailState << traj.getJuncPos(pieceNum), traj.getJuncVel(pieceNum), traj.getJuncAcc(pieceNum);
+            setConditions(headState, tailState, pieceNum);
+            setParameters(traj.getPositions().middleCols(1, pieceNum - 1), ts);
+            return true;
+        }
+
         inline void getTrajectory(Trajectory<5> &traj) const
         {
             traj.clear();
@@ -1,82 +1,324 @@
 # include "trajectory.hpp"
+# include "voxel_map.hpp"
 # include <Eigen/Eigen>
 
+# include <algorithm>
+# include <cfloat>
+# include <cmath>
+
 
 namespace pa_checker
 {
+    // Tracks how far along the trajectory stays visible, i.e., inside the
+    // FOV cone of the body x axis and within max_dist ahead. Samples lie on
+    // a fixed grid anchored at t = 0 and every check() resumes from the
+    // first sample that was invisible in the last call, so that each tick
+    // only evaluates the newly visible samples plus one.
+    // In the exact mode, the first exit time after progress_t is solved
+    // piece by piece instead of sampled, see getExitTime().
+    // With an occlusion map, a sample also has to be in line of sight of
+    // the camera, see setOcclusionMap().
     class Pa_checker
     {
     private:
+        const Trajectory<5> &traj;
+        const double a_max;
+        const double max_dist;
+        const double cos_half_angle;
+        const double dt;
+        const bool exact;
+
         double progress_t;
-        double a_max;
-        double max_dist;
         bool safe;
-        double angle;
+        // grid index of the next sample to test
+        int sample_idx;
+        // piece cursors for the sample sweep and for progress_t
+        int sample_cursor;
+        int progress_cursor;
+
+        // map for line-of-sight tests, nullptr if occlusions are ignored
+        const voxel_map::VoxelMap *occ_map;
+        // the last occluded sample and the camera voxel it was marched from
+        int occluded_idx;
+        Eigen::Vector3i occluded_from;
+
+        // Rays are marched from pos to the samples in time order, and a sample
+        // found occluded is not marched again until the camera leaves its voxel,
+        // as the sweep of the next tick resumes from exactly this sample
+        inline bool occluded(const Eigen::Vector3d &pos, const int &idx, const Eigen::Vector3d &sample)
+        {
+            if (occ_map == nullptr)
+            {
+                return false;
+            }
+            const Eigen::Vector3i from = occ_map->posD2I(pos);
+            if (idx == occluded_idx && from == occluded_from)
+            {
+                return true;
+            }
+            if (occ_map->lineOfSight(pos, sample))
+            {
+                return false;
+            }
+            occluded_idx = idx;
+            occluded_from = from;
+            return true;
+        }
+
+        // Index of the first grid sample after t, where a sample rounding onto t
+        // itself is skipped as it lies at the camera for a fresh checker
+        inline int firstSampleAfter(const double &t) const
+        {
+            return (int)std::floor(t / dt + 1.0e-6) + 1;
+        }
+
+        inline bool visible(const Eigen::Vector3d &h, const Eigen::Vector3d &check_pos) const
+        {
+            const double proj = h.dot(check_pos);
+            return (proj > cos_half_angle * check_pos.norm()) && (proj <= max_dist);
+        }
+
+        // Roots of coeff on (lbound, 1) in normalized time, where the bounds are
+        // widened a little so that the solver never sees a root at either end
+        template <int K, typename RootSet>
+        static inline void solveRoots(const Eigen::Matrix<double, K, 1> &coeff, const double &lbound,
+                                      const double &duration, RootSet &roots)
+        {
+            RootFinder::RootBuffer<2 * K> rts;
+            double l = lbound - 0.0625;
+            double r = 1.0625;
+            if (coeff.cwiseAbs().maxCoeff() < DBL_EPSILON)
+            {
+                return;
+            }
+            while (fabs(RootFinder::polyVal(coeff, l)) < DBL_EPSILON && l < lbound)
+            {
+                l = 0.5 * (l + lbound);
+            }
+            while (fabs(RootFinder::polyVal(coeff, r)) < DBL_EPSILON && r > 1.0)
+            {
+                r = 0.5 * (r + 1.0);
+            }
+            RootFinder::solvePolynomial(coeff, l, r, FLT_EPSILON / duration, rts);
+            for (int i = 0; i < rts.size(); i++)
+            {
+                if (rts[i] > lbound && rts[i] < 1.0)
+                {
+                    roots.insert(rts[i]);
+                }
+            }
+            return;
+        }
+
+        // Divide the factor (s - s0) out of the relative position coefficients
+        // as long as they vanish at s0 within eps, which keeps the direction of
+        // the relative position for s > s0 but removes the tangency at s0
+        static inline void deflate(Piece<5>::CoefficientMat &coeffMat, const double &s0, const double &eps)
+        {
+            Piece<5>::CoefficientMat quotient;
+            quotient.col(0).setZero();
+            for (int k = 0; k < 5; k++)
+            {
+                Eigen::Vector3d val = coeffMat.col(0);
+                for (int j = 1; j < 6; j++)
+                {
+                    quotient.col(j) = val;
+                    val = val * s0 + coeffMat.col(j);
+                }
+                if (val.norm() > eps)
+                {
+                    break;
+                }
+                coeffMat = quotient;
+            }
+            return;
+        }
+
+        // First time no earlier than t0 at which the trajectory leaves the FOV
+        // cone or the max-distance half-space seen from pos with heading h, or
+        // the total duration if it never does. Every piece is first bracketed
+        // by its Bezier control points, whose convex hull contains the piece.
+        // The boundaries of h.d > 0, of (h.d)^2 > c^2 |d|^2 and of h.d <=
+        // max_dist not excluded this way are solved as polynomial roots, and
+        // the visibility is tested between consecutive roots. As the camera is
+        // usually on the trajectory at t0, the FOV conditions are solved for
+        // the deflated relative position there, see deflate().
+        inline double getExitTime(const Eigen::Vector3d &h, const Eigen::Vector3d &pos, const double &t0)
+        {
+            const int N = traj.getPieceNum();
+            double t = t0;
+            const int startIdx = traj.locatePieceIdx(t, progress_cursor);
+            double tStart = t0 - t;
+            for (int i = startIdx; i < N; tStart += traj[i].getDuration(), i++)
+            {
+                const Piece<5> &piece = traj[i];
+                const double T = piece.getDuration();
+                const double lbound = i == startIdx ? std::min(std::max(t / T, 0.0), 1.0) : 0.0;
+                // The search starts strictly after t0, as the trajectory may pass
+                // through pos at t0 and then every condition is tight there
+                const double tol = FLT_EPSILON / T;
+                if (lbound > 1.0 - tol)
+                {
+                    continue;
+                }
+
+                // Each condition holds on a convex set if the cone is no wider
+                // than a half-space, so only those violated by some control
+                // point need to be solved
+                const Piece<5>::CoefficientMat ctrlPts = piece.getPosBezierCtrlPts().colwise() - pos;
+                const Eigen::Matrix<double, 1, 6> ctrlProjs = h.transpose() * ctrlPts;
+                const bool convex = cos_half_angle >= 0.0;
+                const bool projIn = convex && (ctrlProjs.array() > 0.0).all();
+                const bool distIn = convex && (ctrlProjs.array() <= max_dist).all();
+                const bool coneIn = projIn &&
+                                    (ctrlProjs.array().square() >
+                                     cos_half_angle * cos_half_angle * ctrlPts.colwise().squaredNorm().array())
+                                        .all();
+                if (distIn && coneIn)
+                {
+                    continue;
+                }
+
+                Piece<5>::CoefficientMat nPosCoeffMat = piece.normalizePosCoeffMat();
+                nPosCoeffMat.col(5) -= pos;
+                RootFinder::RootBuffer<22> roots;
+                if (!distIn)
+                {
+                    Eigen::Matrix<double, 6, 1> distCoeff = -(nPosCoeffMat.transpose() * h);
+                    distCoeff(5) += max_dist;
+                    solveRoots<6>(distCoeff, lbound + tol, T, roots);
+                }
+                if (!coneIn)
+                {
+                    if (i == startIdx)
+                    {
+                        deflate(nPosCoeffMat, lbound, FLT_EPSILON * (1.0 + pos.norm()));
+                    }
+                    const Eigen::Matrix<double, 6, 1> projCoeff = nPosCoeffMat.transpose() * h;
+                    const Eigen::Matrix<double, 11, 1> coneCoeff =
+                        RootFinder::polySqr<6>(projCoeff) -
+                        cos_half_angle * cos_half_angle *
+                            (RootFinder::polySqr<6>(nPosCoeffMat.row(0).transpose()) +
+                             RootFinder::polySqr<6>(nPosCoeffMat.row(1).transpose()) +
+                             RootFinder::polySqr<6>(nPosCoeffMat.row(2).transpose()));
+                    solveRoots<11>(coneCoeff, lbound + tol, T, roots);
+                    if (!projIn)
+                    {
+                        solveRoots<6>(projCoeff, lbound + tol, T, roots);
+                    }
+                }
+                roots.insert(1.0);
 
+                double l = lbound;
+                for (int j = 0; j < roots.size(); j++)
+                {
+                    if (!visible(h, piece.getPos(0.5 * (l + roots[j]) * T) - pos))
+                    {
+                        return tStart + l * T;
+                    }
+                    l = roots[j];
+                }
+            }
+            return traj.getTotalDuration();
+        }
 
     public:
-        Pa_checker(double progress, double alpha, double amax, double maxdist, bool safeFlag)
+        Pa_checker(const Trajectory<5> &trajectory, double progress, double alpha, double amax, double maxdist, bool safeFlag,
+                   bool exactMode = false)
+            : traj(trajectory), a_max(amax), max_dist(maxdist),
+              cos_half_angle(cos(alpha / 2)), dt(0.05), exact(exactMode),
+              progress_t(progress), safe(safeFlag),
+              sample_idx(0), sample_cursor(-1), progress_cursor(-1),
+              occ_map(nullptr), occluded_idx(-1)
         {
-            progress_t = progress;
-            angle = alpha;
-            a_max = amax;
-            max_dist = maxdist;
-            safe = safeFlag;
+        }
 
+        // Enable occlusion tests against the Occupied voxels of map, which
+        // must outlive the checker, or disable them with nullptr
+        inline void setOcclusionMap(const voxel_map::VoxelMap *map)
+        {
+            occ_map = map;
+            occluded_idx = -1;
         }
 
-        inline void check(Trajectory<5> traj, Eigen::Vector4d quat, Eigen::Vector3d pos, double speed, double delta)
+        inline void check(const Eigen::Vector4d &quat, const Eigen::Vector3d &pos, const double &speed, const double &delta)
         {
             if(progress_t <= delta) progress_t = delta;
 
-            Eigen::Quaterniond q(quat(0),quat(1),quat(2),quat(3));
-            Eigen::Vector3d h = q*Eigen::Vector3d::UnitX();
-            h = h.normalized();
+            // body x axis of the attitude [w, x, y, z]
+            const Eigen::Vector3d h = Eigen::Vector3d(1.0 - 2.0 * (quat(2) * quat(2) + quat(3) * quat(3)),
+                                                      2.0 * (quat(1) * quat(2) + quat(0) * quat(3)),
+                                                      2.0 * (quat(1) * quat(3) - quat(0) * quat(2))).normalized();
 
-            for (double t = progress_t+0.01; t<= traj.getTotalDuration(); t += 0.05)
+            const double totalT = traj.getTotalDuration();
+            if (exact)
             {
-                Eigen::Vector3d check_pos = traj.getPos(t) - pos;
-                Eigen::Vector3d unit_check = check_pos.normalized();
+                double exit_t = getExitTime(h, pos, progress_t);
+                if (occ_map != nullptr)
+                {
+                    // the grid samples before the geometric exit form one batch of
+                    // rays from the same camera position, already confirmed
+                    // samples are skipped and the batch stops at the first occlusion
+                    sample_idx = std::max(sample_idx, firstSampleAfter(progress_t));
+                    for (double t = sample_idx * dt; t < exit_t; t = ++sample_idx * dt)
+                    {
+                        if (occluded(pos, sample_idx, traj.getPos(t, sample_cursor)))
+                        {
+                            exit_t = std::max(progress_t, t - dt);
+                            break;
+                        }
+                    }
+                }
+                if (exit_t < totalT)
+                {
+                    const double s = (traj.getPos(exit_t, progress_cursor) - pos).norm();
+                    safe = (speed * speed - 2 * a_max * s) > 0 ? false : true;
+                }
+                progress_t = exit_t;
+                return;
+            }
 
-                if((h.dot(unit_check) > cos(angle/2) ) && (h.dot(check_pos) <= max_dist) )
+            sample_idx = std::max(sample_idx, firstSampleAfter(progress_t));
+            for (double t = sample_idx * dt; t <= totalT; t = ++sample_idx * dt)
+            {
+                const Eigen::Vector3d sample = traj.getPos(t, sample_cursor);
+                if (visible(h, sample - pos) && !occluded(pos, sample_idx, sample))
                 {
                     progress_t = t;
-                    continue;
                 }
                 else
                 {
-                    double s = (traj.getPos(progress_t)-pos).norm();
-                    safe = (speed*speed - 2* a_max * s )> 0 ? false : true;
-                    //std::cout<< safe << " " << progress_t  <<" " << speed << " " << a_max << " " << s  << std::endl;
+                    const double s = (traj.getPos(progress_t, progress_cursor) - pos).norm();
+                    safe = (speed * speed - 2 * a_max * s) > 0 ? false : true;
                     break;
-                    
-
                 }
-
             }
             return;
-
-
         }
 
-        inline double getProgress()
+        inline double getProgress() const
         {
             return progress_t;
         }
 
-        inline bool getSafeFlag()
+        inline bool getSafeFlag() const
         {
             return safe;
         }
 
+        // Must be called whenever the trajectory is replaced
         inline void clear()
         {
             progress_t = 0.0;
             safe = false;
+            sample_idx = 0;
+            sample_cursor = -1;
+            progress_cursor = -1;
+            occluded_idx = -1;
         }
 
     };
-    
 
 
-}
\ No newline at end of file
+
+}
@@ -84,7 +84,7 @@ inline int polyMod(double *u, double *v, double *r, int lu, int lv)
     return (k <= 0) ? 1 : (k + 1);
 }
 
-inline double polyEval(double *p, int len, double x)
+inline double polyEval(const double *p, int len, double x)
 // Evaluate the polynomial p(x), which has len coefficients
 // Note: Horner scheme should not be employed here !!!
 // Horner scheme has bad numerical stability despite of its efficiency.
@@ -123,11 +123,10 @@ inline double polyEval(double *p, int len, double x)
     return retVal;
 }
 
-inline std::set<double> solveCub(double a, double b, double c, double d)
-// Calculate all roots of a*x^3 + b*x^2 + c*x + d = 0
+template <typename RootSet>
+inline void solveCub(double a, double b, double c, double d, RootSet &roots)
+// Calculate all roots of a*x^3 + b*x^2 + c*x + d = 0 and insert them into roots
 {
-    std::set<double> roots;
-
     constexpr double cos120 = -0.50;
     constexpr double sin120 = 0.866025403784438646764;
 
@@ -230,6 +229,14 @@ inline std::set<double> solveCub(double a, double b, double c, double d)
             roots.insert(2.0 * w * cos120 - bover3a);
         }
     }
+    return;
+}
+
+inline std::set<double> solveCub(double a, double b, double c, double d)
+// Calculate all roots of a*x^3 + b*x^2 + c*x + d = 0
+{
+    std::set<double> roots;
+    solveCub(a, b, c, d, roots);
     return roots;
 }
 
@@ -286,12 +293,11 @@ inline int solveResolvent(double *x, double a, double b, double c)
     }
 }
 
-inline std::set<double> solveQuartMonic(double a, double b, double c, double d)
-// Calculate all roots of the monic quartic equation:
+template <typename RootSet>
+inline void solveQuartMonic(double a, double b, double c, double d, RootSet &roots)
+// Calculate all roots of the monic quartic equation and insert them into roots:
 // x^4 + a*x^3 + b*x^2 + c*x +d = 0
 {
-    std::set<double> roots;
-
     double a3 = -b;
     double b3 = a * c - 4.0 * d;
     double c3 = -a * a * d - c * c + 4.0 * b * d;
@@ -371,21 +377,42 @@ inline std::set<double> solveQuartMonic(double a, double b, double c, double d)
         roots.insert((-p2 - sqrtD) * 0.5);
     }
 
+    return;
+}
+
+inline std::set<double> solveQuartMonic(double a, double b, double c, double d)
+// Calculate all roots of the monic quartic equation:
+// x^4 + a*x^3 + b*x^2 + c*x +d = 0
+{
+    std::set<double> roots;
+    solveQuartMonic(a, b, c, d, roots);
     return roots;
 }
 
-inline std::set<double> solveQuart(double a, double b, double c, double d, double e)
-// Calculate the quartic equation: a*x^4 + b*x^3 + c*x^2 + d*x + e = 0
+template <typename RootSet>
+inline void solveQuart(double a, double b, double c, double d, double e, RootSet &roots)
+// Calculate the quartic equation and insert all roots into roots:
+// a*x^4 + b*x^3 + c*x^2 + d*x + e = 0
 // All coefficients can be zero
 {
     if (fabs(a) < DBL_EPSILON)
     {
-        return solveCub(b, c, d, e);
+        solveCub(b, c, d, e, roots);
     }
     else
     {
-        return solveQuartMonic(b / a, c / a, d / a, e / a);
+        solveQuartMonic(b / a, c / a, d / a, e / a, roots);
     }
+    return;
+}
+
+inline std::set<double> solveQuart(double a, double b, double c, double d, double e)
+// Calculate the quartic equation: a*x^4 + b*x^3 + c*x^2 + d*x + e = 0
+// All coefficients can be zero
+{
+    std::set<double> roots;
+    solveQuart(a, b, c, d, e, roots);
+    return roots;
 }
 
 inline std::set<double> eigenSolveRealRoots(const Eigen::VectorXd &coeffs, double lbound, double ubound, double tol)
@@ -439,7 +466,7 @@ inline double numSignVar(double x, double **sturmSeqs, int *szSeq, int len)
     return signVar;
 };
 
-inline void polyDeri(double *coeffs, double *dcoeffs, int len)
+inline void polyDeri(const double *coeffs, double *dcoeffs, int len)
 // Calculate the derivative poly coefficients of a given poly
 {
     int horder = len - 1;
@@ -530,27 +557,162 @@ inline double safeNewton(const F &func, const DF &dfunc,
     return rts;
 }
 
-inline double shrinkInterval(double *coeffs, int numCoeffs, double lbound, double ubound, double tol)
+inline double shrinkInterval(const double *coeffs, int numCoeffs, double lbound, double ubound, double tol)
 // Calculate a single zero of poly coeffs(x) inside [lbound, ubound]
 // Requirements: coeffs(lbound)*coeffs(ubound) < 0, lbound < ubound
 {
-    double *dcoeffs = new double[numCoeffs - 1];
+    double dcoeffs[RootFinderParam::highestOrder];
     polyDeri(coeffs, dcoeffs, numCoeffs);
     auto func = [&coeffs, &numCoeffs](double x) { return polyEval(coeffs, numCoeffs, x); };
     auto dfunc = [&dcoeffs, &numCoeffs](double x) { return polyEval(dcoeffs, numCoeffs - 1, x); };
     constexpr int maxDblIts = 128;
     double rts = safeNewton(func, dfunc, lbound, ubound, tol, maxDblIts);
-    delete[] dcoeffs;
     return rts;
 }
 
+class SturmSeqsView
+// Sturm sequences stored as raw arrays, the i-th of which has size szSeq[i] and is stored in sturmSeqs[i][]
+{
+public:
+    SturmSeqsView(double **seqs, int *sizes, int length)
+        : sturmSeqs(seqs), szSeq(sizes), len(length) {}
+
+    inline double eval(double x) const
+    {
+        return polyEval(sturmSeqs[0], szSeq[0], x);
+    }
+
+    inline int signVar(double x) const
+    {
+        return numSignVar(x, sturmSeqs, szSeq, len);
+    }
+
+    inline double shrink(int i, double l, double r, double tol) const
+    {
+        return shrinkInterval(sturmSeqs[i], szSeq[i], l, r, tol);
+    }
+
+private:
+    double **sturmSeqs;
+    int *szSeq;
+    int len;
+};
+
+template <int N>
+class SturmChain
+// Sturm sequence of a poly with degree no more than N, held in stack storage
+// Each member is a right-aligned row of a (N + 1) x (N + 1) row-major array,
+// and the whole chain is evaluated at M points with M-wide vector arithmetic
+{
+public:
+    inline void build(const double *coeffs, int len)
+    // The poly has len coefficients stored in coeffs[], 2 <= len <= N + 1
+    // Requirement: leading coefficient must be nonzero
+    {
+        int order = len - 1;
+        double *row0 = seqs + N + 1 - len;
+        double *row1 = seqs + 2 * (N + 1) - order;
+        row0[0] = 1.0;
+        for (int i = 1; i < len; i++)
+        {
+            row0[i] = coeffs[i] / coeffs[0];
+        }
+        for (int i = 0; i < order; i++)
+        {
+            row1[i] = (order - i) * row0[i] / order;
+        }
+        szSeq[0] = len;
+        szSeq[1] = order;
+        num = 2;
+
+        double rem[N + 1];
+        while (szSeq[num - 1] > 1)
+        {
+            int lu = szSeq[num - 2];
+            int sz = polyMod(seqs + (num - 1) * (N + 1) - lu,
+                             seqs + num * (N + 1) - szSeq[num - 1],
+                             rem, lu, szSeq[num - 1]);
+            double lead = rem[lu - sz];
+            if (lead == 0.0)
+            {
+                // The remainder vanishes for repeated roots, so that the chain
+                // ends with the gcd of the poly and its derivative
+                break;
+            }
+            double *rowi = seqs + (num + 1) * (N + 1) - sz;
+            for (int i = 1; i < sz; i++)
+            {
+                rowi[i] = rem[lu - sz + i] / -fabs(lead);
+            }
+            rowi[0] = lead > 0.0 ? -1.0 : 1.0;
+            szSeq[num] = sz;
+            num++;
+        }
+        return;
+    }
+
+    inline double eval(double x) const
+    {
+        return polyEval(seqs + N + 1 - szSeq[0], szSeq[0], x);
+    }
+
+    template <int M>
+    inline void signVars(const double *xs, int *vars) const
+    // Numbers of sign variations of the chain at M points xs[] stored in vars[]
+    {
+        typedef Eigen::Array<double, M, 1> ArrayM;
+        const Eigen::Map<const ArrayM> x(xs);
+        ArrayM y, lasty, xn;
+        Eigen::Array<int, M, 1> var = Eigen::Array<int, M, 1>::Zero();
+        for (int i = 0; i < num; i++)
+        {
+            // Power sums instead of Horner scheme, see polyEval
+            const double *p = seqs + (i + 1) * (N + 1) - 1;
+            y.setConstant(*p);
+            xn = x;
+            for (int j = 1; j < szSeq[i]; j++)
+            {
+                y += *(--p) * xn;
+                xn *= x;
+            }
+            if (i > 0)
+            {
+                var += ((lasty == 0.0) || (lasty * y < 0.0)).template cast<int>();
+            }
+            lasty = y;
+        }
+        for (int j = 0; j < M; j++)
+        {
+            vars[j] = var(j);
+        }
+        return;
+    }
+
+    inline int signVar(double x) const
+    {
+        int var;
+        signVars<1>(&x, &var);
+        return var;
+    }
+
+    inline double shrink(int i, double l, double r, double tol) const
+    {
+        return shrinkInterval(seqs + (i + 1) * (N + 1) - szSeq[i], szSeq[i], l, r, tol);
+    }
+
+private:
+    int num;
+    int szSeq[N + 1];
+    double seqs[(N + 1) * (N + 1)];
+};
+
+template <typename Chain, typename RootSet>
 inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int rnv,
-                         double tol, double **sturmSeqs, int *szSeq, int len,
-                         std::set<double> &rts)
-// Isolate all roots of sturmSeqs[0](x) inside interval (l, r) recursively and store them in rts
-// Requirements: fl := sturmSeqs[0](l) != 0, fr := sturmSeqs[0](r) != 0, l < r,
-//               lnv != rnv, lnv = numSignVar(l), rnv = numSignVar(r)
-//               sturmSeqs[0](x) must have at least one root inside (l, r)
+                         double tol, const Chain &chain, RootSet &rts)
+// Isolate all roots of the first member of the Sturm chain inside interval (l, r) recursively and store them in rts
+// Requirements: fl := chain.eval(l) != 0, fr := chain.eval(r) != 0, l < r,
+//               lnv != rnv, lnv = chain.signVar(l), rnv = chain.signVar(r)
+//               chain.eval(x) must have at least one root inside (l, r)
 {
     int nrts = lnv - rnv;
     double fm;
@@ -564,7 +726,7 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
     {
         if (fl * fr < 0)
         {
-            rts.insert(shrinkInterval(sturmSeqs[0], szSeq[0], l, r, tol));
+            rts.insert(chain.shrink(0, l, r, tol));
             return;
         }
         else
@@ -577,12 +739,12 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
                 // Calculate the root with even multiplicity
                 if (fl * fr < 0)
                 {
-                    rts.insert(shrinkInterval(sturmSeqs[1], szSeq[1], l, r, tol));
+                    rts.insert(chain.shrink(1, l, r, tol));
                     return;
                 }
 
                 m = (l + r) / 2.0;
-                fm = polyEval(sturmSeqs[0], szSeq[0], m);
+                fm = chain.eval(m);
 
                 if (fm == 0 || fabs(r - l) < tol)
                 {
@@ -591,7 +753,7 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
                 }
                 else
                 {
-                    if (lnv == numSignVar(m, sturmSeqs, szSeq, len))
+                    if (lnv == chain.signVar(m))
                     {
                         l = m;
                         fl = fm;
@@ -628,7 +790,7 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
                 m = (r - l) / pow(2.0, bias + 1.0) + l;
                 biased = false;
             }
-            mnv = numSignVar(m, sturmSeqs, szSeq, len);
+            mnv = chain.signVar(m);
 
             if (fabs(r - l) < tol)
             {
@@ -637,7 +799,7 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
             }
             else
             {
-                fm = polyEval(sturmSeqs[0], szSeq[0], m);
+                fm = chain.eval(m);
                 if (fm == 0)
                 {
                     bias++;
@@ -645,8 +807,8 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
                 }
                 else if (lnv != mnv && rnv != mnv)
                 {
-                    recurIsolate(l, m, fl, fm, lnv, mnv, tol, sturmSeqs, szSeq, len, rts);
-                    recurIsolate(m, r, fm, fr, mnv, rnv, tol, sturmSeqs, szSeq, len, rts);
+                    recurIsolate(l, m, fl, fm, lnv, mnv, tol, chain, rts);
+                    recurIsolate(m, r, fm, fr, mnv, rnv, tol, chain, rts);
                     return;
                 }
                 else if (lnv == mnv)
@@ -667,48 +829,75 @@ inline void recurIsolate(double l, double r, double fl, double fr, int lnv, int
     }
 };
 
-inline std::set<double> isolateRealRoots(const Eigen::VectorXd &coeffs, double lbound, double ubound, double tol)
-// Calculate roots of coeffs(x) inside (lbound, rbound) leveraging Sturm theory
+inline double rootRadius(const double *coeffs, int len)
+// Calculate a radius that strictly encloses all roots of coeffs(x)
+// The poly has len coefficients stored in coeffs[], len <= RootFinderParam::highestOrder + 1
 // Requirement: leading coefficient must be nonzero
-//              coeffs(lbound) != 0, coeffs(rbound) != 0, lbound < rbound
 {
-    std::set<double> rts;
-
     // Calculate monic coefficients
-    int order = (int)coeffs.size() - 1;
-    Eigen::VectorXd monicCoeffs(order + 1);
-    monicCoeffs << 1.0, coeffs.tail(order) / coeffs(0);
+    int order = len - 1;
+    double monicCoeffs[RootFinderParam::highestOrder + 1];
+    monicCoeffs[0] = 1.0;
+    for (int i = 1; i < len; i++)
+    {
+        monicCoeffs[i] = coeffs[i] / coeffs[0];
+    }
 
     // Calculate Cauchy’s bound for the roots of a polynomial
-    double rho_c = 1 + monicCoeffs.tail(order).cwiseAbs().maxCoeff();
+    double rho_c = 0.0;
+    for (int i = 1; i < len; i++)
+    {
+        rho_c = std::max(rho_c, fabs(monicCoeffs[i]));
+    }
+    rho_c += 1.0;
 
     // Calculate Kojima’s bound for the roots of a polynomial
-    Eigen::VectorXd nonzeroCoeffs(order + 1);
-    nonzeroCoeffs.setZero();
+    double nonzeroCoeffs[RootFinderParam::highestOrder + 1];
     int nonzeros = 0;
     double tempEle;
     for (int i = 0; i < order + 1; i++)
     {
-        tempEle = monicCoeffs(i);
+        tempEle = monicCoeffs[i];
         if (fabs(tempEle) >= DBL_EPSILON)
         {
-            nonzeroCoeffs(nonzeros++) = tempEle;
+            nonzeroCoeffs[nonzeros++] = tempEle;
         }
     }
-    nonzeroCoeffs = nonzeroCoeffs.head(nonzeros).eval();
-    Eigen::VectorXd kojimaVec = nonzeroCoeffs.tail(nonzeros - 1).cwiseQuotient(nonzeroCoeffs.head(nonzeros - 1)).cwiseAbs();
-    kojimaVec.tail(1) /= 2.0;
-    double rho_k = 2.0 * kojimaVec.maxCoeff();
+    double rho_k = 0.0;
+    for (int i = 0; i < nonzeros - 1; i++)
+    {
+        tempEle = fabs(nonzeroCoeffs[i + 1] / nonzeroCoeffs[i]);
+        rho_k = std::max(rho_k, i == nonzeros - 2 ? tempEle / 2.0 : tempEle);
+    }
+    rho_k *= 2.0;
 
     // Choose a sharper one then loosen it by 1.0 to get an open interval
-    double rho = std::min(rho_c, rho_k) + 1.0;
+    return std::min(rho_c, rho_k) + 1.0;
+}
 
+template <typename RootSet>
+inline void isolateRealRoots(const double *coeffs, int len, double lbound, double ubound, double tol,
+                             RootSet &rts)
+// Calculate roots of coeffs(x) inside (lbound, rbound) leveraging Sturm theory and insert them into rts
+// The poly has len coefficients stored in coeffs[], len <= RootFinderParam::highestOrder + 1
+// Requirement: leading coefficient must be nonzero
+//              coeffs(lbound) != 0, coeffs(rbound) != 0, lbound < rbound
+{
     // Tighten the bound to search in
+    double rho = rootRadius(coeffs, len);
     lbound = std::max(lbound, -rho);
     ubound = std::min(ubound, rho);
 
+    // Calculate monic coefficients
+    int order = len - 1;
+    double monicCoeffs[RootFinderParam::highestOrder + 1];
+    monicCoeffs[0] = 1.0;
+    for (int i = 1; i < len; i++)
+    {
+        monicCoeffs[i] = coeffs[i] / coeffs[0];
+    }
+
     // Build Sturm sequence
-    int len = monicCoeffs.size();
     double sturmSeqs[(RootFinderParam::highestOrder + 1) * (RootFinderParam::highestOrder + 1)];
     int szSeq[RootFinderParam::highestOrder + 1] = {0}; // Explicit ini as zero (gcc may neglect this in -O3)
     double *offsetSeq[RootFinderParam::highestOrder + 1];
@@ -716,7 +905,7 @@ inline std::set<double> isolateRealRoots(const Eigen::VectorXd &coeffs, double l
 
     for (int i = 0; i < len; i++)
     {
-        sturmSeqs[i] = monicCoeffs(i);
+        sturmSeqs[i] = monicCoeffs[i];
         sturmSeqs[i + 1 + len] = (order - i) * sturmSeqs[i] / order;
     }
     szSeq[0] = len;
@@ -747,21 +936,203 @@ inline std::set<double> isolateRealRoots(const Eigen::VectorXd &coeffs, double l
     }
 
     // Isolate all distinct roots inside the open interval recursively
+    const SturmSeqsView chain(offsetSeq, szSeq, len);
     recurIsolate(lbound, ubound,
-                 polyEval(offsetSeq[0], szSeq[0], lbound),
-                 polyEval(offsetSeq[0], szSeq[0], ubound),
-                 numSignVar(lbound, offsetSeq, szSeq, len),
-                 numSignVar(ubound, offsetSeq, szSeq, len),
-                 tol, offsetSeq, szSeq, len, rts);
+                 chain.eval(lbound),
+                 chain.eval(ubound),
+                 chain.signVar(lbound),
+                 chain.signVar(ubound),
+                 tol, chain, rts);
+
+    return;
+}
 
+template <int N, typename RootSet>
+inline void isolateRealRoots(const double *coeffs, int len, double lbound, double ubound, double tol,
+                             SturmChain<N> &chain, RootSet &rts)
+// Stack-storage version of isolateRealRoots for polys of degree no more than N, i.e., 2 <= len <= N + 1
+// Both ends of the chain are evaluated simultaneously
+{
+    double rho = rootRadius(coeffs, len);
+    double bounds[2] = {std::max(lbound, -rho), std::min(ubound, rho)};
+    int vars[2];
+
+    chain.build(coeffs, len);
+    chain.template signVars<2>(bounds, vars);
+    recurIsolate(bounds[0], bounds[1],
+                 chain.eval(bounds[0]),
+                 chain.eval(bounds[1]),
+                 vars[0], vars[1],
+                 tol, chain, rts);
+
+    return;
+}
+
+inline std::set<double> isolateRealRoots(const Eigen::VectorXd &coeffs, double lbound, double ubound, double tol)
+// Calculate roots of coeffs(x) inside (lbound, rbound) leveraging Sturm theory
+// Requirement: leading coefficient must be nonzero
+//              coeffs(lbound) != 0, coeffs(rbound) != 0, lbound < rbound
+{
+    std::set<double> rts;
+    isolateRealRoots(coeffs.data(), (int)coeffs.size(), lbound, ubound, tol, rts);
     return rts;
 }
 
+inline int countRoots(const double *coeffs, int originalSize, double l, double r)
+// Count the number of distinct roots of coeffs(x) inside (l, r), leveraging Sturm theory
+// The poly has originalSize coefficients stored in coeffs[], originalSize <= RootFinderParam::highestOrder + 1
+// Boundary values, i.e., coeffs(l) and coeffs(r), must be nonzero
+{
+    int nRoots = 0;
+
+    int valid = originalSize;
+    for (int i = 0; i < originalSize; i++)
+    {
+        if (fabs(coeffs[i]) < DBL_EPSILON)
+        {
+            valid--;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (valid > 0 && fabs(coeffs[originalSize - 1]) > DBL_EPSILON)
+    {
+        double monicCoeffs[RootFinderParam::highestOrder + 1];
+        monicCoeffs[0] = 1.0;
+        for (int i = 1; i < valid; i++)
+        {
+            monicCoeffs[i] = coeffs[originalSize - valid + i] / coeffs[originalSize - valid];
+        }
+
+        // Build the Sturm sequence
+        int len = valid;
+        int order = len - 1;
+        double sturmSeqs[(RootFinderParam::highestOrder + 1) * (RootFinderParam::highestOrder + 1)];
+        int szSeq[RootFinderParam::highestOrder + 1] = {0}; // Explicit ini as zero (gcc may neglect this in -O3)
+        int num = 0;
+
+        for (int i = 0; i < len; i++)
+        {
+            sturmSeqs[i] = monicCoeffs[i];
+            sturmSeqs[i + 1 + len] = (order - i) * sturmSeqs[i] / order;
+        }
+        szSeq[0] = len;
+        szSeq[1] = len - 1;
+        num += 2;
+
+        bool remainderConstant = false;
+        int idx = 0;
+        while (!remainderConstant)
+        {
+            szSeq[idx + 2] = polyMod(&(sturmSeqs[(idx + 1) * len - szSeq[idx]]),
+                                     &(sturmSeqs[(idx + 2) * len - szSeq[idx + 1]]),
+                                     &(sturmSeqs[(idx + 3) * len - szSeq[idx]]),
+                                     szSeq[idx], szSeq[idx + 1]);
+            remainderConstant = szSeq[idx + 2] == 1;
+            for (int i = 1; i < szSeq[idx + 2]; i++)
+            {
+                sturmSeqs[(idx + 3) * len - szSeq[idx + 2] + i] /= -fabs(sturmSeqs[(idx + 3) * len - szSeq[idx + 2]]);
+            }
+            sturmSeqs[(idx + 3) * len - szSeq[idx + 2]] /= -fabs(sturmSeqs[(idx + 3) * len - szSeq[idx + 2]]);
+            num++;
+            idx++;
+        }
+
+        // Count numbers of sign variations at two boundaries
+        double yl, lastyl, yr, lastyr;
+        lastyl = polyEval(&(sturmSeqs[len - szSeq[0]]), szSeq[0], l);
+        lastyr = polyEval(&(sturmSeqs[len - szSeq[0]]), szSeq[0], r);
+        for (int i = 1; i < num; i++)
+        {
+            yl = polyEval(&(sturmSeqs[(i + 1) * len - szSeq[i]]), szSeq[i], l);
+            yr = polyEval(&(sturmSeqs[(i + 1) * len - szSeq[i]]), szSeq[i], r);
+            if (lastyl == 0.0 || lastyl * yl < 0.0)
+            {
+                ++nRoots;
+            }
+            if (lastyr == 0.0 || lastyr * yr < 0.0)
+            {
+                --nRoots;
+            }
+            lastyl = yl;
+            lastyr = yr;
+        }
+    }
+
+    return nRoots;
+}
+
 } // namespace RootFinderPriv
 
 namespace RootFinder
 {
 
+template <int Capacity>
+class RootBuffer
+// Fixed-capacity replacement of std::set<double> for allocation-free root finding
+// Roots are kept sorted and distinct; insertions beyond Capacity are dropped
+{
+public:
+    RootBuffer() : num(0) {}
+
+    inline void insert(const double &x)
+    {
+        int i = num;
+        while (i > 0 && roots[i - 1] > x)
+        {
+            i--;
+        }
+        if ((i > 0 && roots[i - 1] == x) || num >= Capacity)
+        {
+            return;
+        }
+        for (int j = num; j > i; j--)
+        {
+            roots[j] = roots[j - 1];
+        }
+        roots[i] = x;
+        num++;
+        return;
+    }
+
+    inline void clear()
+    {
+        num = 0;
+    }
+
+    inline int size() const
+    {
+        return num;
+    }
+
+    inline bool empty() const
+    {
+        return num == 0;
+    }
+
+    inline const double &operator[](int i) const
+    {
+        return roots[i];
+    }
+
+    inline const double *begin() const
+    {
+        return roots;
+    }
+
+    inline const double *end() const
+    {
+        return roots + num;
+    }
+
+private:
+    int num;
+    double roots[Capacity];
+};
+
 inline Eigen::VectorXd polyConv(const Eigen::VectorXd &lCoef, const Eigen::VectorXd &rCoef)
 // Calculate the convolution of lCoef(x) and rCoef(x)
 {
@@ -882,6 +1253,40 @@ inline Eigen::VectorXd polySqr(const Eigen::VectorXd &coef)
     return result;
 }
 
+template <int K>
+inline Eigen::Matrix<double, 2 * K - 1, 1> polySqr(const Eigen::Matrix<double, K, 1> &coef)
+// Fixed-size version of polySqr which never touches the heap
+{
+    Eigen::Matrix<double, 2 * K - 1, 1> result;
+    int lbound, rbound;
+    double temp;
+    for (int i = 0; i < 2 * K - 1; i++)
+    {
+        temp = 0;
+        lbound = i - K + 1;
+        lbound = lbound > 0 ? lbound : 0;
+        rbound = K < (i + 1) ? K : (i + 1);
+        rbound += lbound;
+        if (rbound & 1)
+        {
+            rbound >>= 1;
+            temp += coef(rbound) * coef(rbound);
+        }
+        else
+        {
+            rbound >>= 1;
+        }
+
+        for (int j = lbound; j < rbound; j++)
+        {
+            temp += 2.0 * coef(j) * coef(i - j);
+        }
+        result(i) = temp;
+    }
+
+    return result;
+}
+
 inline double polyVal(const Eigen::VectorXd &coeffs, double x,
                       bool numericalStability = true)
 // Evaluate the polynomial at x, i.e., coeffs(x)
@@ -928,15 +1333,40 @@ inline double polyVal(const Eigen::VectorXd &coeffs, double x,
     return retVal;
 }
 
+template <int K>
+inline double polyVal(const Eigen::Matrix<double, K, 1> &coeffs, double x,
+                      bool numericalStability = true)
+// Fixed-size version of polyVal which never touches the heap
+{
+    if (numericalStability)
+    {
+        return RootFinderPriv::polyEval(coeffs.data(), K, x);
+    }
+    else
+    {
+        double retVal = 0.0;
+        for (int i = 0; i < K; i++)
+        {
+            retVal = retVal * x + coeffs(i);
+        }
+        return retVal;
+    }
+}
+
 inline int countRoots(const Eigen::VectorXd &coeffs, double l, double r)
 // Count the number of distinct roots of coeffs(x) inside (l, r), leveraging Sturm theory
 // Boundary values, i.e., coeffs(l) and coeffs(r), must be nonzero
 {
-    int nRoots = 0;
+    return RootFinderPriv::countRoots(coeffs.data(), (int)coeffs.size(), l, r);
+}
 
-    int originalSize = coeffs.size();
-    int valid = originalSize;
-    for (int i = 0; i < originalSize; i++)
+template <int K>
+inline int countRoots(const Eigen::Matrix<double, K, 1> &coeffs, double l, double r)
+// Fixed-size version of countRoots which never touches the heap
+// The Sturm chain is kept in stack storage and evaluated at both boundaries simultaneously
+{
+    int valid = K;
+    for (int i = 0; i < K; i++)
     {
         if (fabs(coeffs(i)) < DBL_EPSILON)
         {
@@ -948,64 +1378,15 @@ inline int countRoots(const Eigen::VectorXd &coeffs, double l, double r)
         }
     }
 
-    if (valid > 0 && fabs(coeffs(originalSize - 1)) > DBL_EPSILON)
+    int nRoots = 0;
+    if (valid > 1 && fabs(coeffs(K - 1)) > DBL_EPSILON)
     {
-        Eigen::VectorXd monicCoeffs(valid);
-        monicCoeffs << 1.0, coeffs.segment(originalSize - valid + 1, valid - 1) / coeffs(originalSize - valid);
-
-        // Build the Sturm sequence
-        int len = monicCoeffs.size();
-        int order = len - 1;
-        double sturmSeqs[(RootFinderParam::highestOrder + 1) * (RootFinderParam::highestOrder + 1)];
-        int szSeq[RootFinderParam::highestOrder + 1] = {0}; // Explicit ini as zero (gcc may neglect this in -O3)
-        int num = 0;
-
-        for (int i = 0; i < len; i++)
-        {
-            sturmSeqs[i] = monicCoeffs(i);
-            sturmSeqs[i + 1 + len] = (order - i) * sturmSeqs[i] / order;
-        }
-        szSeq[0] = len;
-        szSeq[1] = len - 1;
-        num += 2;
-
-        bool remainderConstant = false;
-        int idx = 0;
-        while (!remainderConstant)
-        {
-            szSeq[idx + 2] = RootFinderPriv::polyMod(&(sturmSeqs[(idx + 1) * len - szSeq[idx]]),
-                                                     &(sturmSeqs[(idx + 2) * len - szSeq[idx + 1]]),
-                                                     &(sturmSeqs[(idx + 3) * len - szSeq[idx]]),
-                                                     szSeq[idx], szSeq[idx + 1]);
-            remainderConstant = szSeq[idx + 2] == 1;
-            for (int i = 1; i < szSeq[idx + 2]; i++)
-            {
-                sturmSeqs[(idx + 3) * len - szSeq[idx + 2] + i] /= -fabs(sturmSeqs[(idx + 3) * len - szSeq[idx + 2]]);
-            }
-            sturmSeqs[(idx + 3) * len - szSeq[idx + 2]] /= -fabs(sturmSeqs[(idx + 3) * len - szSeq[idx + 2]]);
-            num++;
-            idx++;
-        }
-
-        // Count numbers of sign variations at two boundaries
-        double yl, lastyl, yr, lastyr;
-        lastyl = RootFinderPriv::polyEval(&(sturmSeqs[len - szSeq[0]]), szSeq[0], l);
-        lastyr = RootFinderPriv::polyEval(&(sturmSeqs[len - szSeq[0]]), szSeq[0], r);
-        for (int i = 1; i < num; i++)
-        {
-            yl = RootFinderPriv::polyEval(&(sturmSeqs[(i + 1) * len - szSeq[i]]), szSeq[i], l);
-            yr = RootFinderPriv::polyEval(&(sturmSeqs[(i + 1) * len - szSeq[i]]), szSeq[i], r);
-            if (lastyl == 0.0 || lastyl * yl < 0.0)
-            {
-                ++nRoots;
-            }
-            if (lastyr == 0.0 || lastyr * yr < 0.0)
-            {
-                --nRoots;
-            }
-            lastyl = yl;
-            lastyr = yr;
-        }
+        RootFinderPriv::SturmChain<K - 1> chain;
+        const double bounds[2] = {l, r};
+        int vars[2];
+        chain.build(coeffs.data() + K - valid, valid);
+        chain.template signVars<2>(bounds, vars);
+        nRoots = vars[0] - vars[1];
     }
 
     return nRoots;
@@ -1109,6 +1490,93 @@ inline std::set<double> solvePolynomial(const Eigen::VectorXd &coeffs, double lb
     return rts;
 }
 
+
+template <int K, int Capacity>
+inline void solvePolynomial(const Eigen::Matrix<double, K, 1> &coeffs, double lbound, double ubound, double tol,
+                            RootBuffer<Capacity> &rts)
+// Fixed-size version of solvePolynomial which never touches the heap
+// Roots of coeffs(x) inside (lbound, rbound) are stored in rts, whose old content is cleared
+// Sturm isolation is always employed for reduced_order >= 5
+// Capacity must be no less than max(K - 1, 4) to hold all roots before filtering
+//
+// Requirement: leading coefficient must be nonzero
+//              coeffs(lbound) != 0, coeffs(rbound) != 0, lbound < rbound
+{
+    RootBuffer<Capacity> allRts;
+
+    int valid = K;
+    for (int i = 0; i < K; i++)
+    {
+        if (fabs(coeffs(i)) < DBL_EPSILON)
+        {
+            valid--;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    int offset = 0;
+    int nonzeros = valid;
+    if (valid > 0)
+    {
+        for (int i = 0; i < valid; i++)
+        {
+            if (fabs(coeffs(K - i - 1)) < DBL_EPSILON)
+            {
+                nonzeros--;
+                offset++;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    if (nonzeros == 0)
+    {
+        allRts.insert(INFINITY);
+        allRts.insert(-INFINITY);
+    }
+    else if (!(nonzeros == 1 && offset == 0))
+    {
+        double ncoeffs[K > 5 ? K : 5] = {0.0};
+        const int pad = nonzeros < 5 ? 5 - nonzeros : 0;
+        for (int i = 0; i < nonzeros; i++)
+        {
+            ncoeffs[pad + i] = coeffs(K - valid + i);
+        }
+
+        if (nonzeros <= 5)
+        {
+            RootFinderPriv::solveQuart(ncoeffs[0], ncoeffs[1], ncoeffs[2], ncoeffs[3], ncoeffs[4], allRts);
+        }
+        else
+        {
+            RootFinderPriv::SturmChain<K - 1> chain;
+            RootFinderPriv::isolateRealRoots(ncoeffs, nonzeros, lbound, ubound, tol, chain, allRts);
+        }
+
+        if (offset > 0)
+        {
+            allRts.insert(0.0);
+        }
+    }
+
+    rts.clear();
+    for (int i = 0; i < allRts.size(); i++)
+    {
+        if (allRts[i] > lbound && allRts[i] < ubound)
+        {
+            rts.insert(allRts[i]);
+        }
+    }
+
+    return;
+}
+
 } // namespace RootFinder
 
 #endif
\ No newline at end of file
@@ -0,0 +1,306 @@
+#ifndef TRAJ_SHM_HPP
+#define TRAJ_SHM_HPP
+
+#include "gcopter/trajectory.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+namespace traj_shm
+{
+
+    // Stream buffer over a fixed memory region, so that the binary layout of
+    // Trajectory is written to and read from shared memory in place
+    class MemoryBuf : public std::streambuf
+    {
+    public:
+        MemoryBuf(char *data, const size_t &size)
+        {
+            setp(data, data + size);
+            setg(data, data, data + size);
+        }
+    };
+
+    // Lock-free single-writer/multi-reader ring of trajectories in POSIX shared
+    // memory. Every slot is guarded by a sequence lock: the writer keeps the
+    // sequence odd while filling a slot, and a reader retries if the sequence
+    // is odd or changes during its read. The writer never waits for readers,
+    // and a reader only retries if the writer laps the ring within one read.
+    template <int D>
+    class TrajectoryRing
+    {
+    private:
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t degree;
+            uint32_t slotNum;
+            uint32_t maxPieceNum;
+            uint64_t slotSize;
+            // Number of completed writes, the latest one lives in slot latest % slotNum
+            std::atomic<uint64_t> latest;
+        };
+
+        struct Slot
+        {
+            std::atomic<uint64_t> seq;
+            double stamp;
+        };
+
+        enum : uint32_t
+        {
+            RING_MAGIC = 0x474E4952u
+        };
+
+        enum
+        {
+            READ_RETRIES = 16
+        };
+
+        std::string shmName;
+        bool owner;
+        size_t mapSize;
+        Header *header;
+
+        inline Slot *getSlot(const uint64_t &version) const
+        {
+            char *base = reinterpret_cast<char *>(header) + sizeof(Header);
+            return reinterpret_cast<Slot *>(base + (version % header->slotNum) * header->slotSize);
+        }
+
+        inline char *getSlotData(Slot *slot) const
+        {
+            return reinterpret_cast<char *>(slot) + sizeof(Slot);
+        }
+
+        inline size_t getSlotCapacity() const
+        {
+            return header->slotSize - sizeof(Slot);
+        }
+
+    public:
+        TrajectoryRing()
+            : owner(false), mapSize(0), header(nullptr) {}
+
+        TrajectoryRing(const TrajectoryRing &) = delete;
+        TrajectoryRing &operator=(const TrajectoryRing &) = delete;
+
+        ~TrajectoryRing()
+        {
+            close();
+        }
+
+        // Create the shared memory as the only writer, where name follows
+        // shm_open(), e.g., "/gcopter_traj". A stale segment of the same name
+        // is unlinked first, and the new one is created exclusively and only
+        // accessible by the owning user, so that no other user can plant or
+        // modify the trajectories that readers decode.
+        inline bool create(const std::string &name,
+                           const int &maxPieceNum,
+                           const int &slotNum = 4)
+        {
+            close();
+            if (maxPieceNum <= 0 || slotNum <= 0)
+            {
+                return false;
+            }
+
+            // Slots are aligned to cache lines to avoid false sharing of sequences
+            const uint64_t slotSize = (sizeof(Slot) + Trajectory<D>::getSerializedSize(maxPieceNum) + 63) / 64 * 64;
+            const size_t totalSize = sizeof(Header) + slotNum * slotSize;
+
+            shm_unlink(name.c_str());
+            const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0)
+            {
+                return false;
+            }
+            if (ftruncate(fd, totalSize) != 0)
+            {
+                ::close(fd);
+                shm_unlink(name.c_str());
+                return false;
+            }
+            void *addr = mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+            {
+                shm_unlink(name.c_str());
+                return false;
+            }
+
+            memset(addr, 0, totalSize);
+            header = new (addr) Header;
+            header->degree = D;
+            header->slotNum = slotNum;
+            header->maxPieceNum = maxPieceNum;
+            header->slotSize = slotSize;
+            header->latest.store(0, std::memory_order_relaxed);
+            for (int i = 0; i < slotNum; i++)
+            {
+                new (getSlot(i)) Slot;
+                getSlot(i)->seq.store(0, std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            header->magic = RING_MAGIC;
+
+            shmName = name;
+            owner = true;
+            mapSize = totalSize;
+            if (!header->latest.is_lock_free())
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        // Attach to a ring created by a writer, possibly in another process
+        inline bool open(const std::string &name)
+        {
+            close();
+            const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+            {
+                ::close(fd);
+                return false;
+            }
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+            {
+                return false;
+            }
+
+            header = reinterpret_cast<Header *>(addr);
+            mapSize = st.st_size;
+            if (header->magic != RING_MAGIC || header->degree != D || header->slotNum == 0 ||
+                sizeof(Header) + header->slotNum * header->slotSize > mapSize)
+            {
+                close();
+                return false;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            shmName = name;
+            return true;
+        }
+
+        inline void close()
+        {
+            if (header != nullptr)
+            {
+                munmap(header, mapSize);
+                if (owner)
+                {
+                    shm_unlink(shmName.c_str());
+                }
+            }
+            shmName.clear();
+            owner = false;
+            mapSize = 0;
+            header = nullptr;
+            return;
+        }
+
+        inline bool isOpen() const
+        {
+            return header != nullptr;
+        }
+
+        // Number of trajectories published so far, cheap enough for polling
+        inline uint64_t getVersion() const
+        {
+            return header == nullptr ? 0 : header->latest.load(std::memory_order_acquire);
+        }
+
+        // Publish a trajectory with its start stamp, only for the creator
+        inline bool write(const Trajectory<D> &traj, const double &stamp)
+        {
+            if (!owner || traj.getPieceNum() > (int)header->maxPieceNum)
+            {
+                return false;
+            }
+
+            const uint64_t version = header->latest.load(std::memory_order_relaxed) + 1;
+            Slot *slot = getSlot(version);
+            const uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+            slot->seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot->stamp = stamp;
+            MemoryBuf buf(getSlotData(slot), getSlotCapacity());
+            std::ostream os(&buf);
+            const bool success = traj.serialize(os);
+
+            slot->seq.store(seq + 2, std::memory_order_release);
+            if (success)
+            {
+                header->latest.store(version, std::memory_order_release);
+            }
+            return success;
+        }
+
+        // Decode the latest trajectory from shared memory, version is the one
+        // given by getVersion() when the trajectory was published. The pieces
+        // are copied out of the slot, since the writer may reuse it at any
+        // time, but into the storage of traj, so a read does not allocate once
+        // traj has been reserved for the max piece number of the ring.
+        inline bool read(Trajectory<D> &traj, double &stamp, uint64_t &version) const
+        {
+            if (header == nullptr)
+            {
+                return false;
+            }
+
+            for (int i = 0; i < READ_RETRIES; i++)
+            {
+                const uint64_t latest = header->latest.load(std::memory_order_acquire);
+                if (latest == 0)
+                {
+                    break;
+                }
+                Slot *slot = getSlot(latest);
+                const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+                if (seq & 1)
+                {
+                    continue;
+                }
+
+                const double slotStamp = slot->stamp;
+                MemoryBuf buf(getSlotData(slot), getSlotCapacity());
+                std::istream is(&buf);
+                const bool success = traj.deserialize(is, (int)header->maxPieceNum);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (success && slot->seq.load(std::memory_order_relaxed) == seq)
+                {
+                    stamp = slotStamp;
+                    version = latest;
+                    return true;
+                }
+            }
+
+            traj.clear();
+            return false;
+        }
+    };
+
+}
+
+#endif
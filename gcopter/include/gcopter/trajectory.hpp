@@ -30,9 +30,13 @@
 #include <Eigen/Eigen>
 
 #include <iostream>
+#include <istream>
+#include <ostream>
 #include <cmath>
 #include <cfloat>
+#include <climits>
 #include <vector>
+#include <algorithm>
 
 template <int D>
 class Piece
@@ -41,16 +45,103 @@ public:
     typedef Eigen::Matrix<double, 3, D + 1> CoefficientMat;
     typedef Eigen::Matrix<double, 3, D> VelCoefficientMat;
     typedef Eigen::Matrix<double, 3, D - 1> AccCoefficientMat;
+    typedef Eigen::Matrix<double, 3, D + 1> StateMat;
 
 private:
     double duration;
     CoefficientMat coeffMat;
+    // derivCoeffMats[k] holds the coefficients of the k-th derivative with k
+    // leading zero columns, so that its c-th column multiplies t^(D-c) for all k
+    CoefficientMat derivCoeffMats[D + 1];
+
+    // p! / (p - k)!, folded at compile time for the unrolled loops on D
+    static constexpr double fallingFactorial(const int p, const int k)
+    {
+        return k <= 0 ? 1.0 : p * fallingFactorial(p - 1, k - 1);
+    }
+
+    // Maps normalized coefficients of degree N, whose c-th column multiplies
+    // s^(N-c), to Bezier control points on s in [0, 1], built once per degree
+    template <int N>
+    static inline const Eigen::Matrix<double, N + 1, N + 1> &getBernsteinMat()
+    {
+        static const Eigen::Matrix<double, N + 1, N + 1> bernsteinMat = []() {
+            Eigen::Matrix<double, N + 1, N + 1> mat = Eigen::Matrix<double, N + 1, N + 1>::Zero();
+            // The k-th control point is sum_{i<=k} C(k, i) / C(N, i) * a_i for s^i
+            for (int k = 0; k <= N; k++)
+            {
+                for (int i = 0; i <= k; i++)
+                {
+                    mat(N - i, k) = fallingFactorial(k, i) / fallingFactorial(N, i);
+                }
+            }
+            return mat;
+        }();
+        return bernsteinMat;
+    }
+
+    inline Eigen::Vector3d evaluate(const int &order, const double &t) const
+    {
+        const CoefficientMat &dCoeffMat = derivCoeffMats[order];
+        Eigen::Vector3d val = dCoeffMat.col(order);
+        for (int i = order + 1; i <= D; i++)
+        {
+            val = val * t + dCoeffMat.col(i);
+        }
+        return val;
+    }
+
+    // Normalized times around [0, 1] at which the squared norm of the polynomial
+    // given by nCoeffMat is stationary, false if the squared norm is constant
+    template <int K>
+    inline bool getSqrNormCriticalTimes(const Eigen::Matrix<double, 3, K> &nCoeffMat,
+                                        RootFinder::RootBuffer<2 * K + 2> &candidates) const
+    {
+        enum
+        {
+            N = 2 * K - 1
+        };
+        Eigen::Matrix<double, N, 1> coeff = RootFinder::polySqr<K>(nCoeffMat.row(0).transpose()) +
+                                            RootFinder::polySqr<K>(nCoeffMat.row(1).transpose()) +
+                                            RootFinder::polySqr<K>(nCoeffMat.row(2).transpose());
+        Eigen::Matrix<double, N - 1, 1> dcoeff;
+        for (int i = 0; i < N - 1; i++)
+        {
+            dcoeff(i) = coeff(i) * (N - 1 - i);
+        }
+        if (dcoeff.squaredNorm() < DBL_EPSILON)
+        {
+            return false;
+        }
+        double l = -0.0625;
+        double r = 1.0625;
+        while (fabs(RootFinder::polyVal(dcoeff, l)) < DBL_EPSILON)
+        {
+            l = 0.5 * l;
+        }
+        while (fabs(RootFinder::polyVal(dcoeff, r)) < DBL_EPSILON)
+        {
+            r = 0.5 * (r + 1.0);
+        }
+        RootFinder::solvePolynomial(dcoeff, l, r, FLT_EPSILON / duration, candidates);
+        return true;
+    }
 
 public:
     Piece() = default;
 
     Piece(double dur, const CoefficientMat &cMat)
-        : duration(dur), coeffMat(cMat) {}
+        : duration(dur), coeffMat(cMat)
+    {
+        for (int k = 0; k <= D; k++)
+        {
+            derivCoeffMats[k].leftCols(k).setZero();
+            for (int i = k; i <= D; i++)
+            {
+                derivCoeffMats[k].col(i) = fallingFactorial(D - i + k, k) * coeffMat.col(i - k);
+            }
+        }
+    }
 
     inline int getDim() const
     {
@@ -72,64 +163,78 @@ public:
         return coeffMat;
     }
 
+    // Coefficients of the order-th derivative padded with leading zero
+    // columns, i.e., the c-th column multiplies t^(D-c) as in coeffMat
+    inline const CoefficientMat &getDerivCoeffMat(const int &order) const
+    {
+        return derivCoeffMats[order];
+    }
+
     inline Eigen::Vector3d getPos(const double &t) const
     {
-        Eigen::Vector3d pos(0.0, 0.0, 0.0);
-        double tn = 1.0;
-        for (int i = D; i >= 0; i--)
-        {
-            pos += tn * coeffMat.col(i);
-            tn *= t;
-        }
-        return pos;
+        return evaluate(0, t);
     }
 
     inline Eigen::Vector3d getVel(const double &t) const
     {
-        Eigen::Vector3d vel(0.0, 0.0, 0.0);
-        double tn = 1.0;
-        int n = 1;
+        return evaluate(1, t);
+    }
+
+    inline Eigen::Vector3d getAcc(const double &t) const
+    {
+        return evaluate(2, t);
+    }
+
+    inline Eigen::Vector3d getJer(const double &t) const
+    {
+        return evaluate(3, t);
+    }
+
+    // The k-th column is the k-th derivative for all k <= order, i.e.,
+    // [pos, vel, acc, jer, snap, ...], evaluated with one power vector
+    inline StateMat getState(const double &t, const int &order = D) const
+    {
+        StateMat state = StateMat::Zero();
+        Eigen::Matrix<double, D + 1, 1> tn;
+        tn(D) = 1.0;
         for (int i = D - 1; i >= 0; i--)
         {
-            vel += n * tn * coeffMat.col(i);
-            tn *= t;
-            n++;
+            tn(i) = tn(i + 1) * t;
+        }
+        for (int k = 0, K = std::min(order, D); k <= K; k++)
+        {
+            state.col(k).noalias() = derivCoeffMats[k] * tn;
         }
-        return vel;
+        return state;
     }
 
-    inline Eigen::Vector3d getAcc(const double &t) const
+    // The same polynomial re-centered at t, i.e., q(s) = p(t + s) for s in
+    // [0, T - t], whose coefficient of s^n is exactly p^(n)(t) / n!
+    inline Piece<D> getShifted(const double &t) const
     {
-        Eigen::Vector3d acc(0.0, 0.0, 0.0);
-        double tn = 1.0;
-        int m = 1;
-        int n = 2;
-        for (int i = D - 2; i >= 0; i--)
+        const StateMat state = getState(t, D);
+        CoefficientMat cMat;
+        double factorial = 1.0;
+        for (int n = 0; n <= D; n++)
         {
-            acc += m * n * tn * coeffMat.col(i);
-            tn *= t;
-            m++;
-            n++;
+            factorial *= n > 0 ? n : 1;
+            cMat.col(D - n) = state.col(n) / factorial;
         }
-        return acc;
+        return Piece<D>(duration - t, cMat);
     }
 
-    inline Eigen::Vector3d getJer(const double &t) const
+    // The same path traversed k times slower, i.e., p(t / k) for t in
+    // [0, k * T], whose n-th derivative is scaled by k^(-n)
+    inline Piece<D> getTimeScaled(const double &k) const
     {
-        Eigen::Vector3d jer(0.0, 0.0, 0.0);
-        double tn = 1.0;
-        int l = 1;
-        int m = 2;
-        int n = 3;
-        for (int i = D - 3; i >= 0; i--)
+        CoefficientMat cMat;
+        double s = 1.0;
+        for (int i = D; i >= 0; i--)
         {
-            jer += l * m * n * tn * coeffMat.col(i);
-            tn *= t;
-            l++;
-            m++;
-            n++;
+            cMat.col(i) = coeffMat.col(i) * s;
+            s /= k;
         }
-        return jer;
+        return Piece<D>(duration * k, cMat);
     }
 
     inline CoefficientMat normalizePosCoeffMat() const
@@ -147,13 +252,11 @@ public:
     inline VelCoefficientMat normalizeVelCoeffMat() const
     {
         VelCoefficientMat nVelCoeffMat;
-        int n = 1;
         double t = duration;
         for (int i = D - 1; i >= 0; i--)
         {
-            nVelCoeffMat.col(i) = n * coeffMat.col(i) * t;
+            nVelCoeffMat.col(i) = derivCoeffMats[1].col(i + 1) * t;
             t *= duration;
-            n++;
         }
         return nVelCoeffMat;
     }
@@ -161,55 +264,66 @@ public:
     inline AccCoefficientMat normalizeAccCoeffMat() const
     {
         AccCoefficientMat nAccCoeffMat;
-        int n = 2;
-        int m = 1;
         double t = duration * duration;
         for (int i = D - 2; i >= 0; i--)
         {
-            nAccCoeffMat.col(i) = n * m * coeffMat.col(i) * t;
-            n++;
-            m++;
+            nAccCoeffMat.col(i) = derivCoeffMats[2].col(i + 2) * t;
             t *= duration;
         }
         return nAccCoeffMat;
     }
 
+    // Bezier control points of position, velocity and acceleration, whose
+    // convex hulls contain the corresponding curves over the whole piece
+    inline CoefficientMat getPosBezierCtrlPts() const
+    {
+        return normalizePosCoeffMat() * getBernsteinMat<D>();
+    }
+
+    inline VelCoefficientMat getVelBezierCtrlPts() const
+    {
+        return normalizeVelCoeffMat() * getBernsteinMat<D - 1>() / duration;
+    }
+
+    inline AccCoefficientMat getAccBezierCtrlPts() const
+    {
+        return normalizeAccCoeffMat() * getBernsteinMat<D - 2>() / (duration * duration);
+    }
+
+    // Conservative axis-aligned bounding box of the position
+    inline void getPosBoundingBox(Eigen::Vector3d &lower, Eigen::Vector3d &upper) const
+    {
+        const CoefficientMat ctrlPts = getPosBezierCtrlPts();
+        lower = ctrlPts.rowwise().minCoeff();
+        upper = ctrlPts.rowwise().maxCoeff();
+        return;
+    }
+
+    // Conservative upper bounds of getMaxVelRate() and getMaxAccRate()
+    inline double getVelRateBound() const
+    {
+        return getVelBezierCtrlPts().colwise().norm().maxCoeff();
+    }
+
+    inline double getAccRateBound() const
+    {
+        return getAccBezierCtrlPts().colwise().norm().maxCoeff();
+    }
+
     inline double getMaxVelRate() const
     {
-        VelCoefficientMat nVelCoeffMat = normalizeVelCoeffMat();
-        Eigen::VectorXd coeff = RootFinder::polySqr(nVelCoeffMat.row(0)) +
-                                RootFinder::polySqr(nVelCoeffMat.row(1)) +
-                                RootFinder::polySqr(nVelCoeffMat.row(2));
-        int N = coeff.size();
-        int n = N - 1;
-        for (int i = 0; i < N; i++)
-        {
-            coeff(i) *= n;
-            n--;
-        }
-        if (coeff.head(N - 1).squaredNorm() < DBL_EPSILON)
+        RootFinder::RootBuffer<2 * D + 2> candidates;
+        if (!getSqrNormCriticalTimes(normalizeVelCoeffMat(), candidates))
         {
             return getVel(0.0).norm();
         }
         else
         {
-            double l = -0.0625;
-            double r = 1.0625;
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), l)) < DBL_EPSILON)
-            {
-                l = 0.5 * l;
-            }
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), r)) < DBL_EPSILON)
-            {
-                r = 0.5 * (r + 1.0);
-            }
-            std::set<double> candidates = RootFinder::solvePolynomial(coeff.head(N - 1), l, r,
-                                                                      FLT_EPSILON / duration);
             candidates.insert(0.0);
             candidates.insert(1.0);
             double maxVelRateSqr = -INFINITY;
             double tempNormSqr;
-            for (std::set<double>::const_iterator it = candidates.begin();
+            for (const double *it = candidates.begin();
                  it != candidates.end();
                  it++)
             {
@@ -225,40 +339,18 @@ public:
 
     inline double getMaxAccRate() const
     {
-        AccCoefficientMat nAccCoeffMat = normalizeAccCoeffMat();
-        Eigen::VectorXd coeff = RootFinder::polySqr(nAccCoeffMat.row(0)) +
-                                RootFinder::polySqr(nAccCoeffMat.row(1)) +
-                                RootFinder::polySqr(nAccCoeffMat.row(2));
-        int N = coeff.size();
-        int n = N - 1;
-        for (int i = 0; i < N; i++)
-        {
-            coeff(i) *= n;
-            n--;
-        }
-        if (coeff.head(N - 1).squaredNorm() < DBL_EPSILON)
+        RootFinder::RootBuffer<2 * D> candidates;
+        if (!getSqrNormCriticalTimes(normalizeAccCoeffMat(), candidates))
         {
             return getAcc(0.0).norm();
         }
         else
         {
-            double l = -0.0625;
-            double r = 1.0625;
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), l)) < DBL_EPSILON)
-            {
-                l = 0.5 * l;
-            }
-            while (fabs(RootFinder::polyVal(coeff.head(N - 1), r)) < DBL_EPSILON)
-            {
-                r = 0.5 * (r + 1.0);
-            }
-            std::set<double> candidates = RootFinder::solvePolynomial(coeff.head(N - 1), l, r,
-                                                                      FLT_EPSILON / duration);
             candidates.insert(0.0);
             candidates.insert(1.0);
             double maxAccRateSqr = -INFINITY;
             double tempNormSqr;
-            for (std::set<double>::const_iterator it = candidates.begin();
+            for (const double *it = candidates.begin();
                  it != candidates.end();
                  it++)
             {
@@ -280,14 +372,18 @@ public:
         {
             return false;
         }
+        else if (getVelRateBound() < maxVelRate)
+        {
+            return true;
+        }
         else
         {
             VelCoefficientMat nVelCoeffMat = normalizeVelCoeffMat();
-            Eigen::VectorXd coeff = RootFinder::polySqr(nVelCoeffMat.row(0)) +
-                                    RootFinder::polySqr(nVelCoeffMat.row(1)) +
-                                    RootFinder::polySqr(nVelCoeffMat.row(2));
+            Eigen::Matrix<double, 2 * D - 1, 1> coeff = RootFinder::polySqr<D>(nVelCoeffMat.row(0).transpose()) +
+                                                        RootFinder::polySqr<D>(nVelCoeffMat.row(1).transpose()) +
+                                                        RootFinder::polySqr<D>(nVelCoeffMat.row(2).transpose());
             double t2 = duration * duration;
-            coeff.tail<1>()(0) -= sqrMaxVelRate * t2;
+            coeff(2 * D - 2) -= sqrMaxVelRate * t2;
             return RootFinder::countRoots(coeff, 0.0, 1.0) == 0;
         }
     }
@@ -300,18 +396,112 @@ public:
         {
             return false;
         }
+        else if (getAccRateBound() < maxAccRate)
+        {
+            return true;
+        }
         else
         {
             AccCoefficientMat nAccCoeffMat = normalizeAccCoeffMat();
-            Eigen::VectorXd coeff = RootFinder::polySqr(nAccCoeffMat.row(0)) +
-                                    RootFinder::polySqr(nAccCoeffMat.row(1)) +
-                                    RootFinder::polySqr(nAccCoeffMat.row(2));
+            Eigen::Matrix<double, 2 * D - 3, 1> coeff = RootFinder::polySqr<D - 1>(nAccCoeffMat.row(0).transpose()) +
+                                                        RootFinder::polySqr<D - 1>(nAccCoeffMat.row(1).transpose()) +
+                                                        RootFinder::polySqr<D - 1>(nAccCoeffMat.row(2).transpose());
             double t2 = duration * duration;
             double t4 = t2 * t2;
-            coeff.tail<1>()(0) -= sqrMaxAccRate * t4;
+            coeff(2 * D - 4) -= sqrMaxAccRate * t4;
             return RootFinder::countRoots(coeff, 0.0, 1.0) == 0;
         }
     }
+
+    // Exact test whether the piece stays strictly inside an H-polytope,
+    // whose rows are [h^T, d] with h^T * x + d < 0 for interior points x
+    inline bool insidePolytope(const Eigen::MatrixX4d &hPoly) const
+    {
+        const CoefficientMat nPosCoeffMat = normalizePosCoeffMat();
+        const Eigen::Matrix<double, D + 1, D + 1> &bernsteinMat = getBernsteinMat<D>();
+        const int faceNum = hPoly.rows();
+        Eigen::Matrix<double, D + 1, 1> coeff, ctrlVals;
+        for (int i = 0; i < faceNum; i++)
+        {
+            // h^T * p(s * T) + d, s in [0, 1], and its Bezier control values,
+            // the first and the last of which are the values at both ends
+            coeff = nPosCoeffMat.transpose() * hPoly.block<1, 3>(i, 0).transpose();
+            coeff(D) += hPoly(i, 3);
+            ctrlVals = bernsteinMat.transpose() * coeff;
+            if (ctrlVals(0) >= 0.0 || ctrlVals(D) >= 0.0)
+            {
+                return false;
+            }
+            if (ctrlVals.maxCoeff() >= 0.0 && RootFinder::countRoots(coeff, 0.0, 1.0) > 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Extrema of thrust, tilt angle and body rate norm through a flatness map
+    // with either zero yaw or the velocity-aligned yaw, probed at the critical
+    // times of speed and acceleration norms as well as at res + 2 uniform
+    // samples including both ends, where the map is only read through its
+    // reentrant overloads with a local FlatMap::Cache
+    template <typename FlatMap>
+    inline void getFlatnessExtrema(const FlatMap &flatMap, const int &res,
+                                   const bool &velocityYaw,
+                                   double &minThr, double &maxThr,
+                                   double &maxTilt, double &maxBdr) const
+    {
+        minThr = INFINITY;
+        maxThr = -INFINITY;
+        maxTilt = -INFINITY;
+        maxBdr = -INFINITY;
+
+        double thr;
+        Eigen::Vector4d quat;
+        Eigen::Vector3d omg;
+        typename FlatMap::Cache cache;
+        auto probe = [&](const double &s) {
+            if (0.0 <= s && 1.0 >= s)
+            {
+                const StateMat state = getState(s * duration, 3);
+                if (velocityYaw)
+                {
+                    flatMap.forwardVelYaw(state.col(1), state.col(2), state.col(3),
+                                          thr, quat, omg, cache);
+                }
+                else
+                {
+                    flatMap.forward(state.col(1), state.col(2), state.col(3),
+                                    0.0, 0.0, thr, quat, omg, cache);
+                }
+                minThr = std::min(minThr, thr);
+                maxThr = std::max(maxThr, thr);
+                maxTilt = std::max(maxTilt, acos(1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2))));
+                maxBdr = std::max(maxBdr, omg.norm());
+            }
+        };
+
+        for (int i = 0; i <= res + 1; i++)
+        {
+            probe(i / (res + 1.0));
+        }
+
+        RootFinder::RootBuffer<2 * D + 2> velCandidates;
+        getSqrNormCriticalTimes(normalizeVelCoeffMat(), velCandidates);
+        for (int i = 0; i < velCandidates.size(); i++)
+        {
+            probe(velCandidates[i]);
+        }
+
+        RootFinder::RootBuffer<2 * D> accCandidates;
+        getSqrNormCriticalTimes(normalizeAccCoeffMat(), accCandidates);
+        for (int i = 0; i < accCandidates.size(); i++)
+        {
+            probe(accCandidates[i]);
+        }
+
+        return;
+    }
 };
 
 template <int D>
@@ -320,6 +510,34 @@ class Trajectory
 private:
     typedef std::vector<Piece<D>> Pieces;
     Pieces pieces;
+    // cumDurs[i] is the end time of the i-th piece, i.e., prefix sums of
+    // durations, which are kept consistent with pieces by all modifiers
+    std::vector<double> cumDurs;
+
+    inline double getStartTime(const int &pieceIdx) const
+    {
+        return pieceIdx > 0 ? cumDurs[pieceIdx - 1] : 0.0;
+    }
+
+    // Header of the binary layout: [magic, version, D, pieceNum]
+    enum : unsigned int
+    {
+        SERIAL_MAGIC = 0x4A415254u,
+        SERIAL_VERSION = 1u
+    };
+
+    template <typename T>
+    static inline void write(std::ostream &os, const T &v)
+    {
+        os.write(reinterpret_cast<const char *>(&v), sizeof(T));
+        return;
+    }
+
+    template <typename T>
+    static inline bool read(std::istream &is, T &v)
+    {
+        return (bool)is.read(reinterpret_cast<char *>(&v), sizeof(T));
+    }
 
 public:
     Trajectory() = default;
@@ -329,9 +547,10 @@ public:
     {
         int N = std::min(durs.size(), cMats.size());
         pieces.reserve(N);
+        cumDurs.reserve(N);
         for (int i = 0; i < N; i++)
         {
-            pieces.emplace_back(durs[i], cMats[i]);
+            emplace_back(durs[i], cMats[i]);
         }
     }
 
@@ -353,13 +572,7 @@ public:
 
     inline double getTotalDuration() const
     {
-        int N = getPieceNum();
-        double totalDuration = 0.0;
-        for (int i = 0; i < N; i++)
-        {
-            totalDuration += pieces[i].getDuration();
-        }
-        return totalDuration;
+        return cumDurs.empty() ? 0.0 : cumDurs.back();
     }
 
     inline Eigen::Matrix3Xd getPositions() const
@@ -379,14 +592,111 @@ public:
         return pieces[i];
     }
 
+    // Call updateCumDurs() if durations are modified through this accessor
     inline Piece<D> &operator[](int i)
     {
         return pieces[i];
     }
 
+    inline void updateCumDurs()
+    {
+        int N = getPieceNum();
+        cumDurs.resize(N);
+        double cumDur = 0.0;
+        for (int i = 0; i < N; i++)
+        {
+            cumDur += pieces[i].getDuration();
+            cumDurs[i] = cumDur;
+        }
+        return;
+    }
+
+    // Split at a global time t into [0, t] and [t, T], where the piece
+    // containing t is cut into two, the latter being re-centered
+    // analytically, so that no resampling is involved
+    inline void splitAt(double t, Trajectory<D> &head, Trajectory<D> &tail) const
+    {
+        head.clear();
+        tail.clear();
+        const int N = getPieceNum();
+        if (N == 0)
+        {
+            return;
+        }
+        t = std::min(std::max(t, 0.0), getTotalDuration());
+        const int idx = locatePieceIdx(t);
+        head.reserve(idx + 1);
+        tail.reserve(N - idx);
+        for (int i = 0; i < idx; i++)
+        {
+            head.emplace_back(pieces[i]);
+        }
+        if (t > 0.0)
+        {
+            head.emplace_back(t, pieces[idx].getCoeffMat());
+        }
+        if (t < pieces[idx].getDuration())
+        {
+            tail.emplace_back(pieces[idx].getShifted(t));
+        }
+        for (int i = idx + 1; i < N; i++)
+        {
+            tail.emplace_back(pieces[i]);
+        }
+        return;
+    }
+
+    // [pos, vel, acc] at a global time t, i.e., the head state from which a
+    // tail is replanned (e.g. by MINCO_S3NU) before being stitched at t
+    inline Eigen::Matrix3d getPVA(double t) const
+    {
+        return getState(t, 2).template leftCols<3>();
+    }
+
+    // Keep [0, t] of this trajectory and append tail, which must start from
+    // the position, velocity and acceleration at t within tol, otherwise
+    // nothing is changed and false is returned
+    inline bool stitch(const double &t, const Trajectory<D> &tail, const double &tol = 1.0e-6)
+    {
+        if (getPieceNum() == 0 || tail.getPieceNum() == 0)
+        {
+            return false;
+        }
+        Eigen::Matrix3d tailHead;
+        tailHead << tail.getJuncPos(0), tail.getJuncVel(0), tail.getJuncAcc(0);
+        if ((getPVA(t) - tailHead).cwiseAbs().maxCoeff() > tol)
+        {
+            return false;
+        }
+        Trajectory<D> head, rest;
+        splitAt(t, head, rest);
+        head.append(tail);
+        *this = head;
+        return true;
+    }
+
+    // Uniformly stretch the time by k > 1 (slow down) or 0 < k < 1 (speed
+    // up) without changing the path, where all durations are scaled by k
+    // and the n-th derivatives by k^(-n), including those at both ends.
+    // A k that is not finite and positive changes nothing and returns false
+    inline bool scaleTime(const double &k)
+    {
+        if (!(std::isfinite(k) && k > 0.0))
+        {
+            return false;
+        }
+        for (Piece<D> &piece : pieces)
+        {
+            piece = piece.getTimeScaled(k);
+        }
+        updateCumDurs();
+        return true;
+    }
+
     inline void clear(void)
     {
         pieces.clear();
+        cumDurs.clear();
         return;
     }
 
@@ -413,11 +723,13 @@ public:
     inline void reserve(const int &n)
     {
         pieces.reserve(n);
+        cumDurs.reserve(n);
         return;
     }
 
     inline void emplace_back(const Piece<D> &piece)
     {
+        cumDurs.push_back(getTotalDuration() + piece.getDuration());
         pieces.emplace_back(piece);
         return;
     }
@@ -425,6 +737,7 @@ public:
     inline void emplace_back(const double &dur,
                              const typename Piece<D>::CoefficientMat &cMat)
     {
+        cumDurs.push_back(getTotalDuration() + dur);
         pieces.emplace_back(dur, cMat);
         return;
     }
@@ -432,27 +745,39 @@ public:
     inline void append(const Trajectory<D> &traj)
     {
         pieces.insert(pieces.end(), traj.begin(), traj.end());
+        updateCumDurs();
         return;
     }
 
+    // Locate the piece of a global time t by binary search in O(log N),
+    // where t is converted into the local time of the returned piece
     inline int locatePieceIdx(double &t) const
     {
         int N = getPieceNum();
-        int idx;
-        double dur;
-        for (idx = 0;
-             idx < N &&
-             t > (dur = pieces[idx].getDuration());
-             idx++)
+        int idx = std::lower_bound(cumDurs.begin(), cumDurs.end(), t) - cumDurs.begin();
+        idx = idx < N ? idx : N - 1;
+        t -= getStartTime(idx);
+        return idx;
+    }
+
+    // Locate the piece of a global time t starting from the piece index of
+    // the last query kept in cursor, which costs O(1) amortized when t is
+    // monotonically increasing, e.g., in control loops or dense sampling
+    inline int locatePieceIdx(double &t, int &cursor) const
+    {
+        int N = getPieceNum();
+        if (cursor < 0 || cursor >= N ||
+            (cursor > 0 && t <= cumDurs[cursor - 1]))
         {
-            t -= dur;
+            cursor = locatePieceIdx(t);
+            return cursor;
         }
-        if (idx == N)
+        while (cursor < N - 1 && t > cumDurs[cursor])
         {
-            idx--;
-            t += pieces[idx].getDuration();
+            cursor++;
         }
-        return idx;
+        t -= getStartTime(cursor);
+        return cursor;
     }
 
     inline Eigen::Vector3d getPos(double t) const
@@ -479,6 +804,82 @@ public:
         return pieces[pieceIdx].getJer(t);
     }
 
+    // Locate the piece once for all derivatives up to order
+    inline typename Piece<D>::StateMat getState(double t, const int &order = D) const
+    {
+        int pieceIdx = locatePieceIdx(t);
+        return pieces[pieceIdx].getState(t, order);
+    }
+
+    // Sample the derivativeOrder-th derivative at t0, t0 + dt, ..., until t1,
+    // where all samples within a piece are evaluated by one matrix product
+    // of its derivative coefficients and a Vandermonde block of local times
+    inline void sampleUniform(const double &t0,
+                              const double &t1,
+                              const double &dt,
+                              Eigen::Matrix3Xd &out,
+                              const int &derivativeOrder = 0) const
+    {
+        const int N = getPieceNum();
+        const int M = (N > 0 && dt > 0.0 && t1 >= t0) ? (int)std::floor((t1 - t0) / dt) + 1 : 0;
+        out.resize(3, M);
+        if (M == 0 || derivativeOrder > D)
+        {
+            out.setZero();
+            return;
+        }
+
+        // the padded derivative coefficients share the same Vandermonde block,
+        // and fixed-size lazy products are used for tiny 3 x (D + 1) blocks
+        Eigen::Matrix<double, D + 1, Eigen::Dynamic> vandermonde;
+        double t = t0;
+        for (int idx = locatePieceIdx(t), j = 0, m; j < M; idx++)
+        {
+            m = idx < N - 1 ? std::min((int)std::floor((cumDurs[idx] - t0) / dt) + 1, M) - j : M - j;
+            if (m <= 0)
+            {
+                continue;
+            }
+            vandermonde.resize(D + 1, m);
+            for (int c = 0; c < m; c++)
+            {
+                t = t0 + (j + c) * dt - getStartTime(idx);
+                vandermonde(D, c) = 1.0;
+                for (int i = D - 1; i >= 0; i--)
+                {
+                    vandermonde(i, c) = vandermonde(i + 1, c) * t;
+                }
+            }
+            out.middleCols(j, m) = pieces[idx].getDerivCoeffMat(derivativeOrder).lazyProduct(vandermonde);
+            j += m;
+        }
+        return;
+    }
+
+    inline Eigen::Vector3d getPos(double t, int &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getPos(t);
+    }
+
+    inline Eigen::Vector3d getVel(double t, int &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getVel(t);
+    }
+
+    inline Eigen::Vector3d getAcc(double t, int &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getAcc(t);
+    }
+
+    inline Eigen::Vector3d getJer(double t, int &cursor) const
+    {
+        int pieceIdx = locatePieceIdx(t, cursor);
+        return pieces[pieceIdx].getJer(t);
+    }
+
     inline Eigen::Vector3d getJuncPos(int juncIdx) const
     {
         if (juncIdx != getPieceNum())
@@ -515,11 +916,15 @@ public:
         }
     }
 
-    inline double getMaxVelRate() const
+    // Pieces are processed concurrently if parallel is set and OpenMP is enabled
+    inline double getMaxVelRate(const bool &parallel = false) const
     {
         int N = getPieceNum();
         double maxVelRate = -INFINITY;
         double tempNorm;
+#ifdef _OPENMP
+#pragma omp parallel for if (parallel) private(tempNorm) reduction(max : maxVelRate)
+#endif
         for (int i = 0; i < N; i++)
         {
             tempNorm = pieces[i].getMaxVelRate();
@@ -528,11 +933,14 @@ public:
         return maxVelRate;
     }
 
-    inline double getMaxAccRate() const
+    inline double getMaxAccRate(const bool &parallel = false) const
     {
         int N = getPieceNum();
         double maxAccRate = -INFINITY;
         double tempNorm;
+#ifdef _OPENMP
+#pragma omp parallel for if (parallel) private(tempNorm) reduction(max : maxAccRate)
+#endif
         for (int i = 0; i < N; i++)
         {
             tempNorm = pieces[i].getMaxAccRate();
@@ -541,27 +949,161 @@ public:
         return maxAccRate;
     }
 
-    inline bool checkMaxVelRate(const double &maxVelRate) const
+    inline bool checkMaxVelRate(const double &maxVelRate, const bool &parallel = false) const
     {
         int N = getPieceNum();
         bool feasible = true;
-        for (int i = 0; i < N && feasible; i++)
+        if (parallel)
         {
-            feasible = feasible && pieces[i].checkMaxVelRate(maxVelRate);
+#ifdef _OPENMP
+#pragma omp parallel for reduction(&& : feasible)
+#endif
+            for (int i = 0; i < N; i++)
+            {
+                feasible = feasible && pieces[i].checkMaxVelRate(maxVelRate);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < N && feasible; i++)
+            {
+                feasible = feasible && pieces[i].checkMaxVelRate(maxVelRate);
+            }
         }
         return feasible;
     }
 
-    inline bool checkMaxAccRate(const double &maxAccRate) const
+    inline bool checkMaxAccRate(const double &maxAccRate, const bool &parallel = false) const
     {
         int N = getPieceNum();
         bool feasible = true;
-        for (int i = 0; i < N && feasible; i++)
+        if (parallel)
         {
-            feasible = feasible && pieces[i].checkMaxAccRate(maxAccRate);
+#ifdef _OPENMP
+#pragma omp parallel for reduction(&& : feasible)
+#endif
+            for (int i = 0; i < N; i++)
+            {
+                feasible = feasible && pieces[i].checkMaxAccRate(maxAccRate);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < N && feasible; i++)
+            {
+                feasible = feasible && pieces[i].checkMaxAccRate(maxAccRate);
+            }
         }
         return feasible;
     }
+
+    // Thrust range, max tilt angle and max body rate norm through a flatness
+    // map (e.g. flatness::FlatnessMap), see Piece::getFlatnessExtrema
+    template <typename FlatMap>
+    inline void getFlatnessExtrema(const FlatMap &flatMap, const int &res,
+                                   const bool &velocityYaw,
+                                   double &minThr, double &maxThr,
+                                   double &maxTilt, double &maxBdr,
+                                   const bool &parallel = false) const
+    {
+        int N = getPieceNum();
+        double minThrAll = INFINITY;
+        double maxThrAll = -INFINITY;
+        double maxTiltAll = -INFINITY;
+        double maxBdrAll = -INFINITY;
+#ifdef _OPENMP
+#pragma omp parallel for if (parallel) reduction(min : minThrAll) reduction(max : maxThrAll, maxTiltAll, maxBdrAll)
+#endif
+        for (int i = 0; i < N; i++)
+        {
+            double pieceMinThr, pieceMaxThr, pieceMaxTilt, pieceMaxBdr;
+            pieces[i].getFlatnessExtrema(flatMap, res, velocityYaw,
+                                         pieceMinThr, pieceMaxThr,
+                                         pieceMaxTilt, pieceMaxBdr);
+            minThrAll = std::min(minThrAll, pieceMinThr);
+            maxThrAll = std::max(maxThrAll, pieceMaxThr);
+            maxTiltAll = std::max(maxTiltAll, pieceMaxTilt);
+            maxBdrAll = std::max(maxBdrAll, pieceMaxBdr);
+        }
+        minThr = minThrAll;
+        maxThr = maxThrAll;
+        maxTilt = maxTiltAll;
+        maxBdr = maxBdrAll;
+        return;
+    }
+
+    // Number of bytes written by serialize() for pieceNum pieces
+    static inline size_t getSerializedSize(const int &pieceNum)
+    {
+        return 2 * sizeof(unsigned int) + 2 * sizeof(int) +
+               pieceNum * (1 + 3 * (D + 1)) * sizeof(double);
+    }
+
+    // Compact binary layout: the header, all durations, then the column-major
+    // coefficient matrices of all pieces, in the native byte order
+    inline bool serialize(std::ostream &os) const
+    {
+        const int N = getPieceNum();
+        write(os, (unsigned int)SERIAL_MAGIC);
+        write(os, (unsigned int)SERIAL_VERSION);
+        write(os, (int)D);
+        write(os, N);
+        for (int i = 0; i < N; i++)
+        {
+            write(os, pieces[i].getDuration());
+        }
+        for (int i = 0; i < N; i++)
+        {
+            os.write(reinterpret_cast<const char *>(pieces[i].getCoeffMat().data()),
+                     3 * (D + 1) * sizeof(double));
+        }
+        return (bool)os;
+    }
+
+    // Read a trajectory written by serialize(), the trajectory is left empty
+    // if the stream is corrupted, holds pieces of another degree or more than
+    // maxPieceNum pieces, or holds a duration that is not finite and positive
+    // or a coefficient that is not finite. The storage of the trajectory is reused, so nothing
+    // is allocated if it already has capacity for all pieces, see reserve().
+    inline bool deserialize(std::istream &is, const int &maxPieceNum = INT_MAX)
+    {
+        clear();
+        unsigned int mg, ver;
+        int deg, N;
+        if (!read(is, mg) || !read(is, ver) || !read(is, deg) || !read(is, N) ||
+            mg != SERIAL_MAGIC || ver != SERIAL_VERSION || deg != D ||
+            N < 0 || N > maxPieceNum)
+        {
+            return false;
+        }
+
+        // Durations are staged in cumDurs, which is rebuilt at the end
+        double dur;
+        for (int i = 0; i < N; i++)
+        {
+            if (!read(is, dur) || !(std::isfinite(dur) && dur > 0.0))
+            {
+                clear();
+                return false;
+            }
+            cumDurs.push_back(dur);
+        }
+        pieces.reserve(N);
+        typename Piece<D>::CoefficientMat cMat;
+        for (int i = 0; i < N; i++)
+        {
+            if (!is.read(reinterpret_cast<char *>(cMat.data()),
+                         3 * (D + 1) * sizeof(double)) ||
+                !cMat.allFinite())
+            {
+                clear();
+                return false;
+            }
+            pieces.emplace_back(cumDurs[i], cMat);
+        }
+        updateCumDurs();
+        return true;
+    }
 };
 
 #endif
\ No newline at end of file
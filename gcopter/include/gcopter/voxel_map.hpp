@@ -26,6 +26,7 @@
 #define VOXEL_MAP_HPP
 
 #include "voxel_dilater.hpp"
+#include <cmath>
 #include <memory>
 #include <vector>
 #include <Eigen/Eigen>
@@ -215,6 +216,43 @@ namespace voxel_map
             }
         }
 
+        // Whether the segment from a to b crosses no Occupied voxel, where
+        // dilated voxels do not block and voxels out of the map do. Voxels are
+        // visited in order along the segment (Amanatides and Woo), so that the
+        // march stops at the first blocking one.
+        inline bool lineOfSight(const Eigen::Vector3d &a, const Eigen::Vector3d &b) const
+        {
+            const Eigen::Vector3d pa = (a - o) / scale;
+            const Eigen::Vector3d dir = (b - o) / scale - pa;
+            Eigen::Vector3i id = pa.array().floor().cast<int>();
+            Eigen::Vector3i inc;
+            Eigen::Vector3d tMax, tDelta;
+            for (int k = 0; k < 3; k++)
+            {
+                inc(k) = dir(k) > 0.0 ? 1 : (dir(k) < 0.0 ? -1 : 0);
+                tDelta(k) = inc(k) != 0 ? 1.0 / std::fabs(dir(k)) : INFINITY;
+                tMax(k) = inc(k) > 0 ? (id(k) + 1 - pa(k)) * tDelta(k)
+                                     : (inc(k) < 0 ? (pa(k) - id(k)) * tDelta(k) : INFINITY);
+            }
+
+            int k;
+            while (true)
+            {
+                if (id(0) < 0 || id(1) < 0 || id(2) < 0 ||
+                    id(0) >= mapSize(0) || id(1) >= mapSize(1) || id(2) >= mapSize(2) ||
+                    voxels[id.dot(step)] == Occupied)
+                {
+                    return false;
+                }
+                if (tMax.minCoeff(&k) > 1.0)
+                {
+                    return true;
+                }
+                id(k) += inc(k);
+                tMax(k) += tDelta(k);
+            }
+        }
+
         inline Eigen::Vector3d posI2D(const Eigen::Vector3i &id) const
         {
             return id.cast<double>() * scale + oc;
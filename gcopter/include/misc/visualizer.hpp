@@ -131,20 +131,19 @@ public:
         if (traj.getPieceNum() > 0)
         {
             double T = 0.01;
-            Eigen::Vector3d lastX = traj.getPos(delta);
-            for (double t = delta+T; t <= progress_t; t += T)
+            Eigen::Matrix3Xd X;
+            traj.sampleUniform(delta, progress_t, T, X);
+            for (int i = 1; i < X.cols(); i++)
             {
                 geometry_msgs::Point point;
-                Eigen::Vector3d X = traj.getPos(t);
-                point.x = lastX(0);
-                point.y = lastX(1);
-                point.z = lastX(2);
+                point.x = X(0, i - 1);
+                point.y = X(1, i - 1);
+                point.z = X(2, i - 1);
                 trajMarker.points.push_back(point);
-                point.x = X(0);
-                point.y = X(1);
-                point.z = X(2);
+                point.x = X(0, i);
+                point.y = X(1, i);
+                point.z = X(2, i);
                 trajMarker.points.push_back(point);
-                lastX = X;
             }
             vistrajPub.publish(vistrajDeleter);
             vistrajPub.publish(trajMarker);
@@ -243,20 +242,19 @@ public:
         if (traj.getPieceNum() > 0)
         {
             double T = 0.01;
-            Eigen::Vector3d lastX = traj.getPos(0.0);
-            for (double t = T; t < traj.getTotalDuration(); t += T)
+            Eigen::Matrix3Xd X;
+            traj.sampleUniform(0.0, traj.getTotalDuration(), T, X);
+            for (int i = 1; i < X.cols(); i++)
             {
                 geometry_msgs::Point point;
-                Eigen::Vector3d X = traj.getPos(t);
-                point.x = lastX(0);
-                point.y = lastX(1);
-                point.z = lastX(2);
+                point.x = X(0, i - 1);
+                point.y = X(1, i - 1);
+                point.z = X(2, i - 1);
                 trajMarker.points.push_back(point);
-                point.x = X(0);
-                point.y = X(1);
-                point.z = X(2);
+                point.x = X(0, i);
+                point.y = X(1, i);
+                point.z = X(2, i);
                 trajMarker.points.push_back(point);
-                lastX = X;
             }
             trajectoryPub.publish(trajMarker);
         }
@@ -6,6 +6,8 @@
 #include "gcopter/voxel_map.hpp"
 #include "gcopter/sfc_gen.hpp"
 #include "gcopter/pa_checker.hpp"
+#include "gcopter/traj_shm.hpp"
+#include "gcopter/attitude_table.hpp"
 
 #include <ros/ros.h>
 #include <ros/console.h>
@@ -42,12 +44,20 @@ struct Config
     double vertDrag;
     double parasDrag;
     double speedEps;
+    bool velocityYaw;
+    double fovHalfAngle;
+    double fovLookahead;
     double weightT;
     std::vector<double> chiVec;
     double smoothingEps;
     int integralIntervs;
     double relCostTol;
     double meshScale;
+    std::string trajShmName;
+    int trajShmMaxPieces;
+    double attitudeTableDt;
+    bool exactVisibility;
+    bool occlusionCheck;
 
     Config(const ros::NodeHandle &nh_priv)
     {
@@ -70,12 +80,20 @@ struct Config
         nh_priv.getParam("VertDrag", vertDrag);
         nh_priv.getParam("ParasDrag", parasDrag);
         nh_priv.getParam("SpeedEps", speedEps);
+        nh_priv.param("VelocityYaw", velocityYaw, false);
+        nh_priv.param("FovHalfAngle", fovHalfAngle, 0.6);
+        nh_priv.param("FovLookahead", fovLookahead, 0.5);
         nh_priv.getParam("WeightT", weightT);
         nh_priv.getParam("ChiVec", chiVec);
         nh_priv.getParam("SmoothingEps", smoothingEps);
         nh_priv.getParam("IntegralIntervs", integralIntervs);
         nh_priv.getParam("RelCostTol", relCostTol);
         nh_priv.getParam("MeshScale", meshScale);
+        nh_priv.param("TrajShmName", trajShmName, std::string(""));
+        nh_priv.param("TrajShmMaxPieces", trajShmMaxPieces, 1024);
+        nh_priv.param("AttitudeTableDt", attitudeTableDt, 0.005);
+        nh_priv.param("ExactVisibility", exactVisibility, false);
+        nh_priv.param("OcclusionCheck", occlusionCheck, false);
     }
 };
 
@@ -96,6 +114,8 @@ private:
     Trajectory<5> traj;
     pa_checker::Pa_checker paChecker;
     double trajStamp;
+    traj_shm::TrajectoryRing<5> trajRing;
+    attitude_table::AttitudeTable<5> attTable;
 
 public:
     GlobalPlanner(const Config &conf,
@@ -104,7 +124,7 @@ public:
           nh(nh_),
           mapInitialized(false),
           visualizer(nh),
-          paChecker(0.0, 40.0, 4.0, 4.0, false)
+          paChecker(traj, 0.0, 40.0, 4.0, 4.0, false, conf.exactVisibility)
     {
         const Eigen::Vector3i xyz((config.mapBound[1] - config.mapBound[0]) / config.voxelWidth,
                                   (config.mapBound[3] - config.mapBound[2]) / config.voxelWidth,
@@ -113,12 +133,22 @@ public:
         const Eigen::Vector3d offset(config.mapBound[0], config.mapBound[2], config.mapBound[4]);
 
         voxelMap = voxel_map::VoxelMap(xyz, offset, config.voxelWidth);
+        if (config.occlusionCheck)
+        {
+            paChecker.setOcclusionMap(&voxelMap);
+        }
 
         mapSub = nh.subscribe(config.mapTopic, 1, &GlobalPlanner::mapCallBack, this,
                               ros::TransportHints().tcpNoDelay());
 
         targetSub = nh.subscribe(config.targetTopic, 1, &GlobalPlanner::targetCallBack, this,
                                  ros::TransportHints().tcpNoDelay());
+
+        if (!config.trajShmName.empty() &&
+            !trajRing.create(config.trajShmName, config.trajShmMaxPieces))
+        {
+            ROS_WARN("Failed to create trajectory shared memory %s", config.trajShmName.c_str());
+        }
     }
 
     inline void mapCallBack(const sensor_msgs::PointCloud2::ConstPtr &msg)
@@ -184,13 +214,15 @@ public:
 
                 gcopter::GCOPTER_PolytopeSFC gcopter;
 
-                // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max]^T
-                // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, thrust_weight]^T
+                // magnitudeBounds = [v_max, omg_max, theta_max, thrust_min, thrust_max, pitch_max,
+                //                    fov_half_angle, fov_lookahead]^T
+                // penaltyWeights = [pos_weight, vel_weight, omg_weight, theta_weight, pitch_weight,
+                //                   thrust_weight, fov_weight]^T
                 // physicalParams = [vehicle_mass, gravitational_acceleration, horitonral_drag_coeff,
                 //                   vertical_drag_coeff, parasitic_drag_coeff, speed_smooth_factor]^T
                 // initialize some constraint parameters
-                Eigen::VectorXd magnitudeBounds(6);
-                Eigen::VectorXd penaltyWeights(6);
+                Eigen::VectorXd magnitudeBounds(8);
+                Eigen::VectorXd penaltyWeights(7);
                 Eigen::VectorXd physicalParams(6);
                 magnitudeBounds(0) = config.maxVelMag;
                 magnitudeBounds(1) = config.maxBdrMag;
@@ -198,12 +230,16 @@ public:
                 magnitudeBounds(3) = config.minThrust;
                 magnitudeBounds(4) = config.maxThrust;
                 magnitudeBounds(5) = config.maxPitch;
+                magnitudeBounds(6) = config.fovHalfAngle;
+                magnitudeBounds(7) = config.fovLookahead;
                 penaltyWeights(0) = (config.chiVec)[0];
                 penaltyWeights(1) = (config.chiVec)[1];
                 penaltyWeights(2) = (config.chiVec)[2];
                 penaltyWeights(3) = (config.chiVec)[3];
                 penaltyWeights(4) = (config.chiVec)[4];
                 penaltyWeights(5) = (config.chiVec)[5];
+                // the FOV penalty is off if ChiVec has no seventh weight
+                penaltyWeights(6) = config.chiVec.size() > 6 ? (config.chiVec)[6] : 0.0;
                 physicalParams(0) = config.vehicleMass;
                 physicalParams(1) = config.gravAcc;
                 physicalParams(2) = config.horizDrag;
@@ -213,6 +249,7 @@ public:
                 const int quadratureRes = config.integralIntervs;
 
                 traj.clear();
+                attTable.clear();
                 paChecker.clear();
 
                 if (!gcopter.setup(config.weightT,
@@ -222,7 +259,8 @@ public:
                                    quadratureRes,
                                    magnitudeBounds,
                                    penaltyWeights,
-                                   physicalParams))
+                                   physicalParams,
+                                   config.velocityYaw))
                 {
                     return;
                 }
@@ -234,8 +272,18 @@ public:
 
                 if (traj.getPieceNum() > 0)
                 {
+                    // Flatness outputs for the control loop are tabulated once per plan
+                    flatness::FlatnessMap flatmap;
+                    flatmap.reset(physicalParams(0), physicalParams(1), physicalParams(2),
+                                  physicalParams(3), physicalParams(4), physicalParams(5));
+                    attTable.build(traj, flatmap, config.attitudeTableDt);
+
                     trajStamp = ros::Time::now().toSec();
                     visualizer.visualize(traj, route);
+                    if (trajRing.isOpen())
+                    {
+                        trajRing.write(traj, trajStamp);
+                    }
                 }
             }
         }
@@ -270,82 +318,32 @@ public:
 
     inline void process()
     {
-        Eigen::VectorXd physicalParams(6);
-        physicalParams(0) = config.vehicleMass;
-        physicalParams(1) = config.gravAcc;
-        physicalParams(2) = config.horizDrag;
-        physicalParams(3) = config.vertDrag;
-        physicalParams(4) = config.parasDrag;
-        physicalParams(5) = config.speedEps;
-
-        flatness::FlatnessMap flatmap;
-        flatmap.reset(physicalParams(0), physicalParams(1), physicalParams(2),
-                      physicalParams(3), physicalParams(4), physicalParams(5));
-
         if (traj.getPieceNum() > 0)
         {
             const double delta = ros::Time::now().toSec() - trajStamp;
-            if (delta > 0.0 && delta < traj.getTotalDuration())
+            attitude_table::Attitude att;
+            if (delta > 0.0 && delta < traj.getTotalDuration() &&
+                attTable.query(delta, att))
             {
-                double thr;
-                Eigen::Vector4d quat;
-                Eigen::Vector3d omg;
-
-                //Joeyyu: calculate the yaw angle------------------------------------------------------------------------
-                Eigen::Vector3d vel = traj.getVel(delta);
-                Eigen::Vector3d pos = traj.getPos(delta);
-                double Psi = std::atan2(vel(1),vel(0));
-
-                flatmap.forward(traj.getVel(delta),
-                                traj.getAcc(delta),
-                                traj.getJer(delta),
-                                Psi, 0.0,
-                                thr, quat, omg);
-                double speed = traj.getVel(delta).norm();
-                
-                //Joeyyu: calculate the yaw angle------------------------------------------------------------------------
-                // Eigen::Vector3d vel = traj.getVel(delta);
-                // Eigen::Vector3d vel_xy(vel(0),vel(1),0);
-                
-                // vel_xy.normalize();
-                // //std::cout << "vel_xy " << " " << vel_xy.transpose() << std::endl;
-                // Eigen::Quaterniond q = Eigen::Quaterniond::FromTwoVectors(Eigen::Vector3d::UnitX(),vel_xy);
-
-                
-                // //q.FromTwoVectors(Eigen::Vector3d::UnitX(),vel_xy);
-                // q.normalize();
-                // //std::cout<<" q: " << " " << q.x() << " " << q.y() << " " << q.z() << " " << q.w()<<std::endl;
-                // Eigen::Quaterniond q0(quat(0),quat(1),quat(2),quat(3));
-                // //std::cout<<" q0: " << " " << q0.x() <<  q0.y() << q0.z() << q0.w()<<std::endl;
-
-                // if(fabs(vel(0)) > 0.01 || fabs(vel(1))> 0.01 )
-                // {
-                //     q0 = q0 * q;
-                //     quat = Eigen::Vector4d(q0.w(),q0.x(),q0.y(),q0.z());
-                //     //std::cout<<" quat: " << " " << quat.transpose()<<std::endl;
-                // }
-                
-
-                
-
-
-                double bodyratemag = omg.norm();
-                double tiltangle = acos(1.0 - 2.0 * (quat(1) * quat(1) + quat(2) * quat(2))) / M_PI * 180.0;
+                // Only [pos, vel] are evaluated here, the attitude is interpolated
+                // from the table built after planning
+                const Piece<5>::StateMat state = traj.getState(delta, 1);
+                const Eigen::Vector3d pos = state.col(0);
+                const Eigen::Vector3d vel = state.col(1);
+                const Eigen::Vector4d &quat = att.quat;
+                const double thr = att.thr;
+                const double speed = vel.norm();
+                const double bodyratemag = att.omg.norm();
+                const double tiltangle = att.tilt / M_PI * 180.0;
                 //Joeyyu: add the pitch and roll angle
-                double pitchangle = asin(2.0*(quat(0)*quat(2)-quat(3)*quat(1)))/ M_PI * 180.0 ;
-                double rollangle = atan2(2.0*(quat(0)*quat(1)+quat(2)*quat(3)),1-2.0*(quat(1)*quat(1)+quat(2)*quat(2))) /M_PI * 180.0;
-                double yawangle = atan2(2.0*(quat(0)*quat(3)+quat(1)*quat(2)),1-2.0*(quat(2)*quat(2)+quat(3)*quat(3)));
-                //double tilt_from_pr = acos(cos(pitchangle)*cos(rollangle));
-                //std::cout<<"[Global_planning]:" << " " << "tilt 1:" << " " << tiltangle  
-                //<< " " <<" tilt 1:" <<" " << tilt_from_pr <<std::endl;
-                //std::cout<<"[Global_planning]:" << " " << "tilt angle:" << " " << tiltangle/3.14 * 180.0 << std::endl;
-                //std::cout<<"[Global_planning]:" << " " << "pitch angle:" << " " << pitchangle/3.14 * 180.0 << std::endl;
-                //std::cout<<"[Global_planning]:" << " " << "roll angle:" << " " << rollangle/3.14 * 180.0 << std::endl;
+                const double pitchangle = att.pitch / M_PI * 180.0;
+                const double rollangle = att.roll / M_PI * 180.0;
+
                 std_msgs::Float64 speedMsg, thrMsg, tiltMsg, bdrMsg;
                 //Joeyyu: add pitch and roll Msg;
                 std_msgs::Float64 pitchMsg, rollMsg;
                 
-                paChecker.check(traj, quat, pos, speed, delta);
+                paChecker.check(quat, pos, speed, delta);
 
                 //std::cout<<speed << " " << paChecker.getProgress() << " " << paChecker.getSafeFlag() <<std::endl;
 
@@ -363,12 +361,12 @@ public:
                 visualizer.rollPub.publish(rollMsg);
 
                 visualizer.bdrPub.publish(bdrMsg);
-                visualizer.visualizeSphere(traj.getPos(delta),
+                visualizer.visualizeSphere(pos,
                                            config.dilateRadius);
 
                 Eigen::Quaterniond q_fov(quat(0),quat(1),quat(2),quat(3));
-                visualizer.pub_fov_visual(traj.getPos(delta),q_fov);
-                visualizer.pub_mesh_drone(traj.getPos(delta),quat, config.meshScale, config.meshResource);
+                visualizer.pub_fov_visual(pos,q_fov);
+                visualizer.pub_mesh_drone(pos,quat, config.meshScale, config.meshResource);
                 visualizer.vistraj_pub(traj, paChecker.getProgress(), delta, paChecker.getSafeFlag());
             }
         }
@@ -0,0 +1,86 @@
+#include "gcopter/minco.hpp"
+#include "gcopter/pa_checker.hpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+// Rest-to-rest trajectory of two 5 s pieces through mid to tail
+static Trajectory<5> restToRest(const Eigen::Vector3d &mid, const Eigen::Vector3d &tail)
+{
+    minco::MINCO_S3NU minco;
+    Eigen::Matrix3d headPVA = Eigen::Matrix3d::Zero();
+    Eigen::Matrix3d tailPVA = Eigen::Matrix3d::Zero();
+    tailPVA.col(0) = tail;
+    Eigen::VectorXd ts(2);
+    ts << 5.0, 5.0;
+    minco.setConditions(headPVA, tailPVA, 2);
+    minco.setParameters(mid, ts);
+    Trajectory<5> traj;
+    minco.getTrajectory(traj);
+    return traj;
+}
+
+// Attitude [w, x, y, z] whose body x axis is dir
+static Eigen::Vector4d headingQuat(const Eigen::Vector3d &dir)
+{
+    const Eigen::Quaterniond q = Eigen::Quaterniond::FromTwoVectors(Eigen::Vector3d::UnitX(), dir);
+    return Eigen::Vector4d(q.w(), q.x(), q.y(), q.z());
+}
+
+TEST(PaChecker, ExactMatchesSampledOnStraightLine)
+{
+    // The camera is on the trajectory at delta, so that every FOV condition
+    // is tight at the start of the search
+    const Trajectory<5> traj = restToRest(Eigen::Vector3d(5.0, 0.0, 0.0), Eigen::Vector3d(10.0, 0.0, 0.0));
+    const Eigen::Vector4d quat = headingQuat(Eigen::Vector3d::UnitX());
+    for (const double amax : {0.5, 1.0, 2.0, 5.0})
+    {
+        for (int k = 1; k <= 98; k++)
+        {
+            const double delta = 0.1 * k;
+            const Eigen::Vector3d pos = traj.getPos(delta);
+            const double speed = traj.getVel(delta).norm();
+            pa_checker::Pa_checker sampled(traj, 0.0, 1.0, amax, 4.0, false, false);
+            pa_checker::Pa_checker exact(traj, 0.0, 1.0, amax, 4.0, false, true);
+            sampled.check(quat, pos, speed, delta);
+            exact.check(quat, pos, speed, delta);
+            ASSERT_GT(exact.getProgress(), delta) << "amax " << amax << " delta " << delta;
+            EXPECT_EQ(exact.getSafeFlag(), sampled.getSafeFlag()) << "amax " << amax << " delta " << delta;
+        }
+    }
+}
+
+TEST(PaChecker, ExactWithinOneSampleOnCurves)
+{
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    for (int n = 0; n < 20; n++)
+    {
+        const Trajectory<5> traj = restToRest(Eigen::Vector3d(5.0, 3.0 * uni(gen), uni(gen)),
+                                              Eigen::Vector3d(10.0, 3.0 * uni(gen), uni(gen)));
+        for (const double alpha : {0.5, 1.0, 2.0})
+        {
+            for (int k = 1; k <= 98; k++)
+            {
+                const double delta = 0.1 * k;
+                const Eigen::Vector3d pos = traj.getPos(delta);
+                const Eigen::Vector3d vel = traj.getVel(delta);
+                const Eigen::Vector4d quat = headingQuat(vel);
+                pa_checker::Pa_checker sampled(traj, 0.0, alpha, 1.0, 4.0, false, false);
+                pa_checker::Pa_checker exact(traj, 0.0, alpha, 1.0, 4.0, false, true);
+                sampled.check(quat, pos, vel.norm(), delta);
+                exact.check(quat, pos, vel.norm(), delta);
+                // the sampled progress is the last visible sample before the exit
+                ASSERT_GE(exact.getProgress(), sampled.getProgress() - 1.0e-9) << "delta " << delta;
+                ASSERT_LE(exact.getProgress(), sampled.getProgress() + 0.05 + 1.0e-9) << "delta " << delta;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+#include "gcopter/root_finder.hpp"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+// Coefficients (highest order first) of (x - r)^2 * q(x)
+template <int K>
+static Eigen::Matrix<double, K + 2, 1> withDoubleRoot(const double &r,
+                                                      const Eigen::Matrix<double, K, 1> &q)
+{
+    const Eigen::Vector3d sq(1.0, -2.0 * r, r * r);
+    Eigen::Matrix<double, K + 2, 1> p = Eigen::Matrix<double, K + 2, 1>::Zero();
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < K; j++)
+        {
+            p(i + j) += sq(i) * q(j);
+        }
+    }
+    return p;
+}
+
+TEST(RootFinder, CountRootsCubicWithDoubleRoot)
+{
+    // (x - 0.5)^2 (x - 2)
+    Eigen::Vector4d p(1.0, -3.0, 2.25, -0.5);
+    EXPECT_EQ(RootFinder::countRoots<4>(p, 0.0, 1.0), 1);
+    EXPECT_EQ(RootFinder::countRoots(Eigen::VectorXd(p), 0.0, 1.0), 1);
+    EXPECT_EQ(RootFinder::countRoots<4>(p, 0.0, 3.0), 2);
+    EXPECT_EQ(RootFinder::countRoots<4>(p, 1.0, 3.0), 1);
+}
+
+TEST(RootFinder, CountRootsSexticWithDoubleRoot)
+{
+    // (x - 0.25)^2 (x^2 + 1) (x^2 + 2) has a single distinct root in (0, 0.5)
+    Eigen::Matrix<double, 5, 1> q;
+    q << 1.0, 0.0, 3.0, 0.0, 2.0;
+    const Eigen::Matrix<double, 7, 1> p = withDoubleRoot<5>(0.25, q);
+    EXPECT_EQ(RootFinder::countRoots<7>(p, 0.0, 0.5), 1);
+    EXPECT_EQ(RootFinder::countRoots(Eigen::VectorXd(p), 0.0, 0.5), 1);
+}
+
+TEST(RootFinder, FixedSizeCountRootsMatchesDynamic)
+{
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    for (int t = 0; t < 2000; t++)
+    {
+        Eigen::Matrix<double, 5, 1> q;
+        for (int i = 0; i < 5; i++)
+        {
+            q(i) = uni(gen);
+        }
+        q(0) = 1.0;
+        const Eigen::Matrix<double, 7, 1> p = withDoubleRoot<5>(0.05 + 0.4 * (t % 97) / 97.0, q);
+        ASSERT_EQ(RootFinder::countRoots<7>(p, 0.0, 0.5),
+                  RootFinder::countRoots(Eigen::VectorXd(p), 0.0, 0.5));
+
+        Eigen::Matrix<double, 8, 1> r;
+        for (int i = 0; i < 8; i++)
+        {
+            r(i) = uni(gen);
+        }
+        ASSERT_EQ(RootFinder::countRoots<8>(r, -0.7, 0.9),
+                  RootFinder::countRoots(Eigen::VectorXd(r), -0.7, 0.9));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}